@@ -0,0 +1,91 @@
+/* Copyright (c) 2017-2025, Michael Santos <michael.santos@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Measure the cost of read(2) and write(2) before and after the process
+ * restrictions are applied. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <err.h>
+#include <fcntl.h>
+#include <time.h>
+
+#include "../restrict_process.h"
+
+#ifndef BENCH_ITERATIONS
+#define BENCH_ITERATIONS 1000000
+#endif
+
+static double bench(int in, int out);
+
+int main(int argc, char *argv[]) {
+  const char *name = argc > 1 ? argv[1] : RESTRICT_PROCESS;
+  int in;
+  int out;
+  double unrestricted;
+  double restricted;
+  int fd[2];
+
+  in = open("/dev/zero", O_RDONLY);
+  if (in < 0)
+    err(EXIT_FAILURE, "open: /dev/zero");
+
+  out = open("/dev/null", O_WRONLY);
+  if (out < 0)
+    err(EXIT_FAILURE, "open: /dev/null");
+
+  fd[0] = in;
+  fd[1] = out;
+
+  unrestricted = bench(in, out);
+
+  if (restrict_process_init() < 0)
+    err(3, "restrict_process_init");
+
+  if (restrict_process_stdin(fd, 2) < 0)
+    err(3, "restrict_process_stdin");
+
+  restricted = bench(in, out);
+
+  (void)printf("%s: read+write: %.1f ns/op (unrestricted: %.1f ns/op, "
+               "overhead: %.1f ns/op)\n",
+               name, restricted, unrestricted, restricted - unrestricted);
+
+  exit(0);
+}
+
+static double bench(int in, int out) {
+  struct timespec t0;
+  struct timespec t1;
+  char buf[1];
+  long i;
+
+  if (clock_gettime(CLOCK_MONOTONIC, &t0) < 0)
+    err(EXIT_FAILURE, "clock_gettime");
+
+  for (i = 0; i < BENCH_ITERATIONS; i++) {
+    if (read(in, buf, sizeof(buf)) != sizeof(buf))
+      err(EXIT_FAILURE, "read");
+    if (write(out, buf, sizeof(buf)) != sizeof(buf))
+      err(EXIT_FAILURE, "write");
+  }
+
+  if (clock_gettime(CLOCK_MONOTONIC, &t1) < 0)
+    err(EXIT_FAILURE, "clock_gettime");
+
+  return ((t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec)) /
+         BENCH_ITERATIONS;
+}
@@ -12,6 +12,10 @@
  * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
+#ifdef __linux__
+#define _GNU_SOURCE /* F_SETPIPE_SZ */
+#endif
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdnoreturn.h>
@@ -20,71 +24,100 @@
 
 #include <err.h>
 #include <getopt.h>
+#include <limits.h>
 #include <sys/param.h>
+#include <sys/stat.h>
 #include <time.h>
 
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/wait.h>
 
 #ifndef HAVE_STRTONUM
 #include "strtonum.h"
 #endif
+#include "prv.h"
 #include "restrict_process.h"
 
-#ifdef CLOCK_MONOTONIC_COARSE
-#define PRV_CLOCK_MONOTONIC CLOCK_MONOTONIC_COARSE
-#else
-#define PRV_CLOCK_MONOTONIC CLOCK_MONOTONIC
-#endif
-
-#define PRV_VERSION "1.0.2"
+#define PRV_CONTROL_MAXBUF 256
 
-#ifndef PRV_MAXBUF
-#define PRV_MAXBUF 8192
-#endif
+/* supervisor mode: default pipe size and max restart delay (seconds) */
+#define PRV_PIPE_SIZE 1048576
+#define PRV_BACKOFF_MAX 60
 
-#define DATA_MAX_LEN 64
-#define HOSTNAME_MAX_LEN 16
+/* default spool file size */
+#define PRV_SPOOL_SIZE 1048576
 
-enum { PRV_WR_BLOCK = 0, PRV_WR_DROP, PRV_WR_EXIT };
+/* record file header: "PRVR" followed by the format version */
+#define PRV_RECORD_MAGIC "PRVR"
+#define PRV_RECORD_VERSION 1
 
 typedef struct {
-  int verbose;
-  size_t limit;
-  size_t count;
-  size_t frag;
-  int window;
-  struct timespec t0;
-  char hostname[HOSTNAME_MAX_LEN];
-  char *plugin;
-  char *type;
-  size_t maxlen;
-  size_t maxid;
-  int write_error;
-} prv_state_t;
-
+  FILE *record;
+  struct timespec record_t0;
+  FILE *replay;
+  size_t replay_speed;
+  struct timespec replay_now;
+  int control;
+  char control_buf[PRV_CONTROL_MAXBUF];
+  size_t control_len;
+  char **cmd;
+  size_t restart;
+  int pipe_size;
+  int capture;
+  int err;
+  prv_state_t *errs;
+} prv_cli_t;
+
+static volatile sig_atomic_t prv_signal;
+static volatile sig_atomic_t prv_hangup;
+
+static const char *const prv_write_error_name[] = {
+    [PRV_WR_BLOCK] = "block", [PRV_WR_DROP] = "drop", [PRV_WR_EXIT] = "exit"};
+
+static int prv_clock_replay(prv_state_t *s, struct timespec *tp);
+static int prv_record_open(prv_cli_t *c, const char *path);
+static int prv_record(prv_state_t *s, const char *buf, size_t buflen);
+static int prv_replay_open(prv_cli_t *c, const char *path);
+static int prv_replay(prv_state_t *s);
+static int prv_varint_write(FILE *fp, uint64_t n);
+static int prv_varint_read(FILE *fp, uint64_t *n);
+static int prv_control_open(prv_cli_t *c, const char *path);
+static int prv_control(prv_state_t *s);
+static void prv_control_command(prv_state_t *s, char *cmd);
+static int prv_supervise(prv_state_t *s);
+static int prv_supervisor(prv_state_t *s, pid_t reader, int out, int errfd);
+static pid_t prv_spawn(prv_cli_t *c, int out, int errfd);
+static int prv_pipe(prv_state_t *s, int fd[2]);
+static void prv_sighandler(int sig);
 static int prv_input(prv_state_t *s);
-static int prv_output(prv_state_t *s, char *buf, size_t buflen);
-static int prv_notify(prv_state_t *s, time_t t, int offset, size_t total,
-                      char *buf, size_t n);
-static int prv_notify_escape(prv_state_t *s, char *buf, size_t n);
+static int prv_read(prv_state_t *s, int fd);
 static noreturn void usage(void);
 
 extern char *__progname;
 
-#define VERBOSE(__s, __n, ...)                                                 \
-  do {                                                                         \
-    if (__s->verbose >= __n) {                                                 \
-      (void)fprintf(stderr, __VA_ARGS__);                                      \
-    }                                                                          \
-  } while (0)
-
 static const struct option long_options[] = {
     {"service", required_argument, NULL, 's'},
+    {"spool", required_argument, NULL, 'Q'},
+    {"spool-size", required_argument, NULL, 'Z'},
     {"hostname", required_argument, NULL, 'H'},
+    {"capture-stderr", no_argument, NULL, 'E'},
+    {"control", required_argument, NULL, 'C'},
+    {"count", required_argument, NULL, 'c'},
+    {"count-sample", required_argument, NULL, 'K'},
+    {"count-type", required_argument, NULL, 'G'},
     {"limit", required_argument, NULL, 'l'},
     {"max-event-length", required_argument, NULL, 'M'},
     {"max-event-id", required_argument, NULL, 'I'},
+    {"pipe-size", required_argument, NULL, 'P'},
+    {"record", required_argument, NULL, 'r'},
+    {"replay", required_argument, NULL, 'R'},
+    {"replay-speed", required_argument, NULL, 'X'},
+    {"restart", required_argument, NULL, 'A'},
+    {"state", required_argument, NULL, 'S'},
+    {"top", required_argument, NULL, 'T'},
     {"window", required_argument, NULL, 'w'},
     {"write-error", required_argument, NULL, 'W'},
     {"verbose", no_argument, NULL, 'v'},
@@ -93,24 +126,34 @@ static const struct option long_options[] = {
 
 int main(int argc, char *argv[]) {
   int ch;
-  prv_state_t s = {0};
+  prv_state_t s;
+  prv_state_t e;
+  prv_cli_t c = {0};
   char *p;
   const char *errstr = NULL;
-
-  if (restrict_process_init() < 0)
-    err(3, "restrict_process_init");
-
-  s.window = 1;
-
-  /* @99:99:99@ */
-  s.maxid = 99;
-  s.maxlen = 255 - 10;
+  char *state = NULL;
+  char *record = NULL;
+  char *replay = NULL;
+  char *control = NULL;
+  char *spool = NULL;
+  size_t spool_size = PRV_SPOOL_SIZE;
+  int fd[4];
+  size_t nfd = 0;
+
+  prv_init(&s);
+  s.arg = &c;
+
+  c.replay_speed = 1;
+  c.control = -1;
+  c.pipe_size = PRV_PIPE_SIZE;
+  c.err = -1;
 
   if (setvbuf(stdout, NULL, _IOLBF, 0) < 0)
     err(EXIT_FAILURE, "setvbuf");
 
-  while ((ch = getopt_long(argc, argv, "l:hH:I:M:s:w:W:v", long_options,
-                           NULL)) != -1) {
+  while ((ch = getopt_long(argc, argv,
+                           "A:c:C:EG:K:l:hH:I:M:P:Q:r:R:s:S:T:w:W:X:vZ:",
+                           long_options, NULL)) != -1) {
     switch (ch) {
     case 's':
       p = strchr(optarg, '/');
@@ -122,13 +165,78 @@ int main(int argc, char *argv[]) {
       s.plugin = optarg;
       s.type = p;
 
-      if (strlen(s.plugin) >= DATA_MAX_LEN)
+      if (strlen(s.plugin) >= PRV_DATA_MAX_LEN)
         errx(EXIT_FAILURE, "invalid plugin: %s", s.plugin);
 
-      if (strlen(s.type) >= DATA_MAX_LEN)
+      if (strlen(s.type) >= PRV_DATA_MAX_LEN)
         errx(EXIT_FAILURE, "invalid type: %s", s.type);
       break;
+    case 'S':
+      state = optarg;
+      break;
+    case 'Q':
+      spool = optarg;
+      break;
+    case 'Z':
+      spool_size = strtonum(optarg, 4096, 1 << 30, &errstr);
+      if (errstr != NULL)
+        errx(EXIT_FAILURE, "strtonum: %s", errstr);
+      break;
+    case 'C':
+      control = optarg;
+      break;
+    case 'A':
+      if (strcmp(optarg, "always") == 0) {
+        c.restart = SIZE_MAX;
+        break;
+      }
+      c.restart = strtonum(optarg, 0, 0xffff, &errstr);
+      if (errstr != NULL)
+        errx(EXIT_FAILURE, "strtonum: %s", errstr);
+      break;
+    case 'E':
+      c.capture = 1;
+      break;
+    case 'c':
+      if (prv_rule_add(&s, optarg) < 0)
+        errx(EXIT_FAILURE, "invalid count rule: <name>=<regex>: %s", optarg);
+      break;
+    case 'G':
+      if (prv_count_type(&s, optarg) < 0)
+        errx(EXIT_FAILURE, "invalid count type: derive|gauge: %s", optarg);
+      break;
+    case 'K':
+      s.sample = strtonum(optarg, 0, 0xffff, &errstr);
+      if (errstr != NULL)
+        errx(EXIT_FAILURE, "strtonum: %s", errstr);
+      break;
+    case 'P':
+      c.pipe_size = strtonum(optarg, 0, INT_MAX, &errstr);
+      if (errstr != NULL)
+        errx(EXIT_FAILURE, "strtonum: %s", errstr);
+      break;
+    case 'r':
+      record = optarg;
+      break;
+    case 'R':
+      replay = optarg;
+      break;
+    case 'X':
+      c.replay_speed = strtonum(optarg, 0, 0xffff, &errstr);
+      if (errstr != NULL)
+        errx(EXIT_FAILURE, "strtonum: %s", errstr);
+      break;
+    case 'T':
+      s.top = strtonum(optarg, 0, PRV_TOP_MAX, &errstr);
+      if (errstr != NULL)
+        errx(EXIT_FAILURE, "strtonum: %s", errstr);
+      break;
     case 'l':
+      if (strchr(optarg, '/') != NULL) {
+        if (prv_tier_add(&s, optarg) < 0)
+          errx(EXIT_FAILURE, "invalid limit: <number>/<period>: %s", optarg);
+        break;
+      }
       s.limit = strtonum(optarg, 0, 0xffff, &errstr);
       if (errstr != NULL)
         errx(EXIT_FAILURE, "strtonum: %s", errstr);
@@ -139,18 +247,12 @@ int main(int argc, char *argv[]) {
         errx(EXIT_FAILURE, "strtonum: %s", errstr);
       break;
     case 'W':
-      if (strcmp(optarg, "block") == 0)
-        s.write_error = PRV_WR_BLOCK;
-      else if (strcmp(optarg, "drop") == 0)
-        s.write_error = PRV_WR_DROP;
-      else if (strcmp(optarg, "exit") == 0)
-        s.write_error = PRV_WR_EXIT;
-      else
+      if (prv_write_error(&s, optarg) < 0)
         errx(EXIT_FAILURE, "invalid option: %s: block|drop|exit", optarg);
 
       break;
     case 'H':
-      if (strlen(optarg) >= HOSTNAME_MAX_LEN)
+      if (strlen(optarg) >= PRV_HOSTNAME_MAX_LEN)
         errx(EXIT_FAILURE, "invalid hostname: %s", optarg);
       (void)memcpy(s.hostname, optarg, strlen(optarg));
       break;
@@ -173,196 +275,745 @@ int main(int argc, char *argv[]) {
     }
   }
 
+  /* supervisor mode: collectd-prv [options] -- command args... */
+  if (optind < argc) {
+    if (replay != NULL)
+      errx(EXIT_FAILURE, "--replay: cannot be used with a command");
+
+    c.cmd = argv + optind;
+
+    /* returns in the process reading the command output */
+    if (prv_supervise(&s) < 0)
+      err(EXIT_FAILURE, "supervise");
+  }
+
+  if (restrict_process_init() < 0)
+    err(3, "restrict_process_init");
+
   if (s.write_error != PRV_WR_BLOCK &&
       fcntl(fileno(stdout), F_SETFL, O_NONBLOCK) < 0)
     err(EXIT_FAILURE, "fcntl");
 
-  if (s.hostname[0] == '\0') {
-    if (gethostname(s.hostname, HOSTNAME_MAX_LEN - 1) < 0)
-      err(EXIT_FAILURE, "gethostname");
+  if (control != NULL) {
+    if (prv_control_open(&c, control) < 0)
+      err(EXIT_FAILURE, "control: %s", control);
+    fd[nfd++] = c.control;
   }
 
-  if (s.plugin == NULL)
-    s.plugin = "stdout";
+  if (record != NULL && replay != NULL)
+    errx(EXIT_FAILURE, "--record and --replay are mutually exclusive");
 
-  if (s.type == NULL)
-    s.type = "prv";
+  if (record != NULL) {
+    if (prv_record_open(&c, record) < 0)
+      err(EXIT_FAILURE, "record: %s", record);
+    fd[nfd++] = fileno(c.record);
+    s.input = prv_record;
+  }
 
-  if (clock_gettime(PRV_CLOCK_MONOTONIC, &(s.t0)) < 0)
-    err(EXIT_FAILURE, "clock_gettime(CLOCK_MONOTONIC)");
+  if (replay != NULL) {
+    if (prv_replay_open(&c, replay) < 0)
+      err(EXIT_FAILURE, "replay: %s", replay);
+    fd[nfd++] = fileno(c.replay);
+    s.clock = prv_clock_replay;
+  }
 
-  if (restrict_process_stdin() < 0)
+  if (prv_start(&s) < 0)
+    err(EXIT_FAILURE, "prv_start");
+
+  if (state != NULL && prv_state_open(&s, state) < 0)
+    err(EXIT_FAILURE, "state: %s", state);
+
+  if (spool != NULL && prv_spool_open(&s, spool, spool_size) < 0)
+    err(EXIT_FAILURE, "spool: %s", spool);
+
+  /* stderr of the command: line buffering and rate limits are separate
+   * from stdout */
+  if (c.err >= 0) {
+    e = s;
+    e.severity = PRV_SEV_WARNING;
+    e.input = NULL;
+    e.state = NULL;
+    e.top = 0;
+    e.sketch = NULL;
+    e.nrule = 0;
+    e.spool = NULL;
+    e.buflen = 0;
+    c.errs = &e;
+    fd[nfd++] = c.err;
+  }
+
+  if (restrict_process_stdin(fd, nfd) < 0)
     err(3, "restrict_process_stdin");
 
+  if (c.replay != NULL) {
+    if (prv_replay(&s) < 0)
+      err(111, "prv_replay");
+
+    if (prv_count_report(&s, time(NULL)) < 0)
+      err(111, "prv_count_report");
+
+    (void)fprintf(stderr,
+                  "REPLAY:lines=%zu:emitted=%zu:discarded=%zu:"
+                  "fragmented=%zu\n",
+                  s.stats.lines, s.stats.emitted, s.stats.discarded,
+                  s.stats.fragmented);
+    exit(0);
+  }
+
   if (prv_input(&s) < 0)
     err(111, "prv_input");
 
+  if (prv_count_report(&s, time(NULL)) < 0)
+    err(111, "prv_count_report");
+
+  if (c.record != NULL && fflush(c.record) < 0)
+    err(111, "record");
+
   exit(0);
 }
 
-static int prv_input(prv_state_t *s) {
+/* replay: time is the timestamp of the current record */
+static int prv_clock_replay(prv_state_t *s, struct timespec *tp) {
+  prv_cli_t *c = s->arg;
+
+  *tp = c->replay_now;
+  return 0;
+}
+
+static int prv_record_open(prv_cli_t *c, const char *path) {
+  c->record = fopen(path, "wbe");
+  if (c->record == NULL)
+    return -1;
+
+  if (fwrite(PRV_RECORD_MAGIC, 4, 1, c->record) != 1 ||
+      fputc(PRV_RECORD_VERSION, c->record) == EOF)
+    return -1;
+
+  if (fflush(c->record) < 0)
+    return -1;
+
+  return clock_gettime(CLOCK_MONOTONIC, &c->record_t0);
+}
+
+/* Record format: varint(delta usec), varint(length), line */
+static int prv_record(prv_state_t *s, const char *buf, size_t buflen) {
+  prv_cli_t *c = s->arg;
+  struct timespec t1;
+  uint64_t usec;
+
+  if (clock_gettime(CLOCK_MONOTONIC, &t1) < 0)
+    return -1;
+
+  usec = (uint64_t)(t1.tv_sec - c->record_t0.tv_sec) * 1000000 +
+         (t1.tv_nsec - c->record_t0.tv_nsec) / 1000;
+
+  /* advance by the rounded delta so rounding errors do not accumulate */
+  c->record_t0.tv_sec += usec / 1000000;
+  c->record_t0.tv_nsec += (usec % 1000000) * 1000;
+  if (c->record_t0.tv_nsec >= 1000000000) {
+    c->record_t0.tv_sec++;
+    c->record_t0.tv_nsec -= 1000000000;
+  }
+
+  if (prv_varint_write(c->record, usec) < 0 ||
+      prv_varint_write(c->record, buflen) < 0)
+    return -1;
+
+  if (fwrite(buf, 1, buflen, c->record) != buflen)
+    return -1;
+
+  return 0;
+}
+
+static int prv_replay_open(prv_cli_t *c, const char *path) {
+  char magic[4];
+
+  c->replay = fopen(path, "rbe");
+  if (c->replay == NULL)
+    return -1;
+
+  if (fread(magic, sizeof(magic), 1, c->replay) != 1 ||
+      memcmp(magic, PRV_RECORD_MAGIC, sizeof(magic)) != 0 ||
+      fgetc(c->replay) != PRV_RECORD_VERSION) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  return 0;
+}
+
+static int prv_replay(prv_state_t *s) {
+  prv_cli_t *c = s->arg;
   char buf[PRV_MAXBUF];
+  struct timespec start;
+  struct timespec now;
+  uint64_t usec;
+  uint64_t elapsed = 0;
+  uint64_t buflen;
+
+  if (clock_gettime(CLOCK_MONOTONIC, &start) < 0)
+    return -1;
+
+  for (;;) {
+    if (prv_varint_read(c->replay, &usec) < 0) {
+      if (feof(c->replay))
+        return 0;
+      return -1;
+    }
+
+    if (prv_varint_read(c->replay, &buflen) < 0) {
+      if (feof(c->replay))
+        goto TRUNCATED;
+      goto ERR;
+    }
+
+    if (buflen >= sizeof(buf))
+      goto ERR;
+
+    if (fread(buf, 1, buflen, c->replay) != buflen) {
+      if (feof(c->replay))
+        goto TRUNCATED;
+      goto ERR;
+    }
+
+    buf[buflen] = '\0';
+
+    elapsed += usec;
+    c->replay_now.tv_sec = elapsed / 1000000;
+    c->replay_now.tv_nsec = (elapsed % 1000000) * 1000;
+
+    /* pace to the original timing divided by the replay speed */
+    if (c->replay_speed > 0) {
+      uint64_t due = elapsed / c->replay_speed;
+      uint64_t real;
+
+      if (clock_gettime(CLOCK_MONOTONIC, &now) < 0)
+        return -1;
+
+      real = (uint64_t)(now.tv_sec - start.tv_sec) * 1000000 +
+             (now.tv_nsec - start.tv_nsec) / 1000;
 
-  while (fgets(buf, sizeof(buf), stdin) != NULL) {
-    if (prv_output(s, buf, strlen(buf)) < 0) {
-      if (errno == EAGAIN) {
-        VERBOSE(s, 1, "PIPE FULL:dropped:%s", buf);
-        if (s->write_error == PRV_WR_DROP)
-          continue;
+      if (due > real) {
+        struct timespec rqtp = {.tv_sec = (due - real) / 1000000,
+                                .tv_nsec = ((due - real) % 1000000) * 1000};
+
+        while (nanosleep(&rqtp, &rqtp) < 0) {
+          if (errno != EINTR)
+            return -1;
+        }
       }
+    }
+
+    if (prv_line(s, buf, buflen) < 0)
       return -1;
+  }
+
+TRUNCATED:
+  /* the recording process was killed while writing a record */
+  warnx("replay: truncated record");
+  return 0;
+
+ERR:
+  errno = EINVAL;
+  return -1;
+}
+
+static int prv_varint_write(FILE *fp, uint64_t n) {
+  do {
+    int c = n & 0x7f;
+
+    n >>= 7;
+    if (n > 0)
+      c |= 0x80;
+
+    if (fputc(c, fp) == EOF)
+      return -1;
+  } while (n > 0);
+
+  return 0;
+}
+
+static int prv_varint_read(FILE *fp, uint64_t *n) {
+  uint64_t v = 0;
+  int shift;
+  int c;
+
+  for (shift = 0; shift < 64; shift += 7) {
+    c = fgetc(fp);
+    if (c == EOF)
+      return -1;
+
+    v |= (uint64_t)(c & 0x7f) << shift;
+
+    if ((c & 0x80) == 0) {
+      *n = v;
+      return 0;
     }
   }
 
+  errno = EINVAL;
+  return -1;
+}
+
+static int prv_control_open(prv_cli_t *c, const char *path) {
+  if (mkfifo(path, 0600) < 0 && errno != EEXIST)
+    return -1;
+
+  /* opened for writing so the FIFO does not return EOF when a writer
+   * closes */
+  c->control = open(path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+  if (c->control < 0)
+    return -1;
+
   return 0;
 }
 
-static int prv_output(prv_state_t *s, char *buf, size_t buflen) {
-  struct timespec t1;
-  time_t t;
-  int sec;
-  size_t chunks;
-  size_t n;
-  ssize_t rem;
+/* Read and apply control commands: called when the FIFO is readable */
+static int prv_control(prv_state_t *s) {
+  prv_cli_t *c = s->arg;
+  ssize_t n;
+  char *nl;
+  char *cmd;
 
-  if (buflen == 0)
-    return 0;
+  n = read(c->control, c->control_buf + c->control_len,
+           sizeof(c->control_buf) - 1 - c->control_len);
+
+  if (n < 0)
+    return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
 
-  if (clock_gettime(PRV_CLOCK_MONOTONIC, &t1) < 0)
-    err(EXIT_FAILURE, "clock_gettime(CLOCK_MONOTONIC)");
+  c->control_len += n;
+  c->control_buf[c->control_len] = '\0';
 
-  sec = t1.tv_sec - s->t0.tv_sec;
+  cmd = c->control_buf;
 
-  if (sec >= s->window) {
-    s->count = 0;
-    s->t0.tv_sec = t1.tv_sec;
-    s->t0.tv_nsec = 0;
+  while ((nl = strchr(cmd, '\n')) != NULL) {
+    *nl = '\0';
+    prv_control_command(s, cmd);
+    cmd = nl + 1;
   }
 
-  VERBOSE(s, 3, "INTERVAL:%d/%d\n", sec, s->window);
+  c->control_len -= cmd - c->control_buf;
 
-  if ((s->limit > 0) && (s->count >= s->limit)) {
-    VERBOSE(s, 2, "DISCARD:%zu/%zu:%s", s->count, s->limit, buf);
-    return 0;
+  /* discard commands exceeding the buffer size */
+  if (c->control_len == sizeof(c->control_buf) - 1)
+    c->control_len = 0;
+
+  (void)memmove(c->control_buf, cmd, c->control_len);
+
+  return 0;
+}
+
+static void prv_control_command(prv_state_t *s, char *cmd) {
+  const char *errstr = NULL;
+  char *arg;
+  long long n;
+
+  arg = strchr(cmd, ' ');
+  if (arg != NULL)
+    *arg++ = '\0';
+
+  if (strcmp(cmd, "dump") == 0) {
+    (void)fprintf(stderr,
+                  "COUNTERS:count=%zu:limit=%zu:window=%d:write-error=%s:"
+                  "lines=%zu:emitted=%zu:discarded=%zu:fragmented=%zu\n",
+                  s->count, s->limit, s->window,
+                  prv_write_error_name[s->write_error],
+                  s->stats.lines, s->stats.emitted, s->stats.discarded,
+                  s->stats.fragmented);
+    return;
   }
 
-  /* Don't include trailing newline */
-  if (buf[buflen - 1] == '\n')
-    buflen--;
+  if (arg == NULL)
+    goto ERR;
+
+  if (strcmp(cmd, "limit") == 0 && strchr(arg, '/') != NULL) {
+    if (prv_tier_add(s, arg) < 0)
+      goto ERR;
+  } else if (strcmp(cmd, "limit") == 0) {
+    n = strtonum(arg, 0, 0xffff, &errstr);
+    if (errstr != NULL)
+      goto ERR;
+    s->limit = n;
+  } else if (strcmp(cmd, "window") == 0) {
+    n = strtonum(arg, 1, 0xffff, &errstr);
+    if (errstr != NULL)
+      goto ERR;
+    s->window = n;
+  } else if (strcmp(cmd, "verbose") == 0) {
+    n = strtonum(arg, 0, 0xffff, &errstr);
+    if (errstr != NULL)
+      goto ERR;
+    s->verbose = n;
+  } else if (strcmp(cmd, "write-error") == 0) {
+    int flags;
+
+    if (prv_write_error(s, arg) < 0)
+      goto ERR;
+
+    flags = fcntl(fileno(stdout), F_GETFL);
+    if (flags < 0)
+      goto ERR;
+
+    flags = (s->write_error == PRV_WR_BLOCK) ? flags & ~O_NONBLOCK
+                                             : flags | O_NONBLOCK;
+
+    if (fcntl(fileno(stdout), F_SETFL, flags) < 0)
+      goto ERR;
+  } else {
+    goto ERR;
+  }
 
-  if (buflen == 0)
-    return 0;
+  VERBOSE(s, 1, "CONTROL:%s %s\n", cmd, arg);
+  return;
 
-  /* number of fragments: 0 or > 0 */
-  chunks = buflen / s->maxlen;
+ERR:
+  VERBOSE(s, 1, "CONTROL:invalid:%s\n", cmd);
+}
 
-  /* length of trailing partial fragment */
-  rem = buflen % s->maxlen;
+/* Supervisor mode: the command writes to a pipe read by a child process
+ * which is restricted as usual. The parent restarts the command with
+ * exponential backoff and exits when the reader exits. */
+static int prv_supervise(prv_state_t *s) {
+  prv_cli_t *c = s->arg;
+  int out[2];
+  int errfd[2] = {-1, -1};
+  pid_t reader;
 
-  /* number of messages: 1 or > 1 */
-  n = chunks + (rem == 0 ? 0 : 1);
+  if (prv_pipe(s, out) < 0)
+    return -1;
 
-  s->count += n;
+  if (c->capture && prv_pipe(s, errfd) < 0)
+    return -1;
 
-  if ((s->limit > 0) && (s->count > s->limit)) {
-    VERBOSE(s, 2, "FRAGLIMIT:count=%zu/limit=%zu/frags=%zu/rem=%zu:%s",
-            s->count, s->limit, n, rem, buf);
-    return 0;
-  }
+  reader = fork();
 
-  t = time(NULL);
+  switch (reader) {
+  case -1:
+    return -1;
 
-  switch (n) {
-  case 1:
-    if (prv_notify(s, t, 1, 1, buf, buflen) < 0)
+  case 0:
+    if (dup2(out[0], STDIN_FILENO) < 0)
       return -1;
+
+    (void)close(out[0]);
+    (void)close(out[1]);
+
+    if (errfd[1] >= 0)
+      (void)close(errfd[1]);
+
+    c->err = errfd[0];
+    return 0;
+
+  default:
     break;
+  }
 
-  default: {
-    size_t i;
+  (void)close(out[0]);
 
-    s->frag = (s->frag % s->maxid) + 1;
+  if (errfd[0] >= 0)
+    (void)close(errfd[0]);
 
-    for (i = 0; i < chunks; i++) {
-      char *frag = buf + (s->maxlen * i);
-      int fraglen = MIN(strlen(frag), s->maxlen);
+  exit(prv_supervisor(s, reader, out[1], errfd[1]));
+}
 
-      if (prv_notify(s, t, i + 1, n, frag, fraglen) < 0)
-        return -1;
+static int prv_supervisor(prv_state_t *s, pid_t reader, int out, int errfd) {
+  prv_cli_t *c = s->arg;
+  struct sigaction act = {0};
+  struct timespec start = {0};
+  struct timespec now = {0};
+  time_t backoff = 1;
+  size_t restart = 0;
+  pid_t pid = -1;
+  pid_t p;
+  int status;
+  int rv = 0;
+
+  act.sa_handler = prv_sighandler;
+  (void)sigemptyset(&act.sa_mask);
+
+  if (sigaction(SIGTERM, &act, NULL) < 0 || sigaction(SIGINT, &act, NULL) < 0 ||
+      sigaction(SIGHUP, &act, NULL) < 0)
+    err(EXIT_FAILURE, "sigaction");
+
+  if (restrict_process_supervisor() < 0)
+    err(3, "restrict_process_supervisor");
+
+  while (prv_signal == 0) {
+    if (pid < 0) {
+      if (clock_gettime(CLOCK_MONOTONIC, &start) < 0)
+        err(EXIT_FAILURE, "clock_gettime");
+
+      pid = prv_spawn(c, out, errfd);
+      if (pid < 0) {
+        warn("fork");
+        rv = 111;
+      } else {
+        VERBOSE(s, 1, "SUPERVISE:spawn:pid=%d:restart=%zu\n", (int)pid,
+                restart);
+      }
     }
 
-    if (rem > 0) {
-      if (prv_notify(s, t, n, n, buf + (s->maxlen * (n - 1)), rem) < 0)
-        return -1;
+    if (pid > 0) {
+      p = waitpid(-1, &status, 0);
+
+      if (p < 0) {
+        if (errno != EINTR)
+          err(EXIT_FAILURE, "waitpid");
+
+        /* SIGHUP is passed to the command, which keeps running */
+        if (prv_hangup) {
+          prv_hangup = 0;
+          if (kill(-pid, SIGHUP) < 0)
+            (void)kill(pid, SIGHUP);
+        }
+
+        continue;
+      }
+
+      /* the reader exited: stop the command */
+      if (p == reader) {
+        if (kill(-pid, SIGTERM) < 0)
+          (void)kill(pid, SIGTERM);
+        (void)waitpid(pid, NULL, 0);
+        return WIFEXITED(status) ? WEXITSTATUS(status) : 111;
+      }
+
+      if (p != pid)
+        continue;
+
+      rv = WIFEXITED(status) ? WEXITSTATUS(status)
+                             : 128 + WTERMSIG(status);
+
+      VERBOSE(s, 1, "SUPERVISE:exit:pid=%d:status=%d\n", (int)pid, rv);
+
+      pid = -1;
     }
+
+    if (restart >= c->restart)
+      break;
+
+    restart++;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &now) < 0)
+      err(EXIT_FAILURE, "clock_gettime");
+
+    /* the command ran long enough: reset the delay */
+    if (now.tv_sec - start.tv_sec >= PRV_BACKOFF_MAX)
+      backoff = 1;
+
+    {
+      struct timespec rqtp = {.tv_sec = backoff};
+
+      while (nanosleep(&rqtp, &rqtp) < 0 && prv_signal == 0)
+        ;
+    }
+
+    backoff = MIN(backoff * 2, PRV_BACKOFF_MAX);
   }
 
-  break;
+  if (pid > 0) {
+    int sig = prv_signal == 0 ? SIGTERM : prv_signal;
+
+    if (kill(-pid, sig) < 0)
+      (void)kill(pid, sig);
+    (void)waitpid(pid, NULL, 0);
   }
 
-  return n;
+  /* the reader drains the pipe and exits on EOF */
+  (void)close(out);
+  if (errfd >= 0)
+    (void)close(errfd);
+
+  while (waitpid(reader, &status, 0) < 0) {
+    if (errno != EINTR)
+      err(EXIT_FAILURE, "waitpid");
+  }
+
+  if (!WIFEXITED(status))
+    return 111;
+
+  return WEXITSTATUS(status) != 0 ? WEXITSTATUS(status) : rv;
 }
 
-static int prv_notify(prv_state_t *s, time_t t, int offset, size_t total,
-                      char *buf, size_t n) {
-  if (fprintf(stdout,
-              "PUTNOTIF host=%s severity=okay time=%lld plugin=%s "
-              "type=%s message=\"",
-              s->hostname, (long long)t, s->plugin, s->type) < 0)
+static pid_t prv_spawn(prv_cli_t *c, int out, int errfd) {
+  struct sigaction act = {0};
+  pid_t pid;
+
+  pid = fork();
+
+  switch (pid) {
+  case -1:
     return -1;
 
-  if (total > 1) {
-    if (fprintf(stdout, "@%zu:%d:%zu@", s->frag, offset, total) < 0)
-      return -1;
+  case 0:
+    break;
+
+  default:
+    /* the command and its children are signaled as a group */
+    (void)setpgid(pid, pid);
+    return pid;
   }
 
-  if (prv_notify_escape(s, buf, n) < 0)
+  (void)setpgid(0, 0);
+
+  act.sa_handler = SIG_DFL;
+  (void)sigemptyset(&act.sa_mask);
+  (void)sigaction(SIGTERM, &act, NULL);
+  (void)sigaction(SIGINT, &act, NULL);
+  (void)sigaction(SIGHUP, &act, NULL);
+
+  if (dup2(out, STDOUT_FILENO) < 0)
+    _exit(127);
+
+  if (errfd >= 0 && dup2(errfd, STDERR_FILENO) < 0)
+    _exit(127);
+
+  (void)execvp(c->cmd[0], c->cmd);
+  warn("%s", c->cmd[0]);
+  _exit(127);
+}
+
+/* Create a pipe and increase the buffer size, if supported */
+static int prv_pipe(prv_state_t *s, int fd[2]) {
+#ifdef F_SETPIPE_SZ
+  prv_cli_t *c = s->arg;
+#endif
+
+  if (pipe(fd) < 0)
     return -1;
 
-  if (fprintf(stdout, "\"\n") < 0)
+  if (fcntl(fd[0], F_SETFD, FD_CLOEXEC) < 0 ||
+      fcntl(fd[1], F_SETFD, FD_CLOEXEC) < 0)
     return -1;
 
+#ifdef F_SETPIPE_SZ
+  if (c->pipe_size > 0 && fcntl(fd[1], F_SETPIPE_SZ, c->pipe_size) < 0)
+    VERBOSE(s, 1, "SUPERVISE:pipe-size:%d:%s\n", c->pipe_size,
+            strerror(errno));
+#endif
+
   return 0;
 }
 
-static int prv_notify_escape(prv_state_t *s, char *buf, size_t n) {
-  size_t i;
+static void prv_sighandler(int sig) {
+  if (sig == SIGHUP)
+    prv_hangup = 1;
+  else
+    prv_signal = sig;
+}
 
-  for (i = 0; i < n; i++) {
-    switch (buf[i]) {
-    case '"':
-      if (fprintf(stdout, "\\\"") < 0)
-        return -1;
-      break;
-    case '\\':
-      if (fprintf(stdout, "\\\\") < 0)
+/* Read stdin and the stderr of a supervised command. Control commands are
+ * applied and spooled lines are sent between reads. */
+static int prv_input(prv_state_t *s) {
+  prv_cli_t *c = s->arg;
+  int rv;
+  int i;
+  struct pollfd fds[3] = {
+      {.fd = STDIN_FILENO, .events = POLLIN},
+      {.fd = c->err, .events = POLLIN},
+      {.fd = c->control, .events = POLLIN},
+  };
+
+  /* stdin only: block in read() */
+  if (c->control < 0 && c->err < 0 && s->spool == NULL && s->nrule == 0) {
+    while ((rv = prv_read(s, STDIN_FILENO)) > 0)
+      ;
+    return rv;
+  }
+
+  while (fds[0].fd >= 0 || fds[1].fd >= 0) {
+    /* counters are reported and spooled lines are sent when the rate
+     * limit window rolls over */
+    rv = poll(fds, 3, s->spool == NULL && s->nrule == 0 ? -1 : 1000);
+
+    if (rv < 0) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+
+    if (rv == 0) {
+      if (prv_tick(s) < 0)
         return -1;
-      break;
-    default:
-      if (fprintf(stdout, "%c", buf[i]) < 0)
+      continue;
+    }
+
+    if ((fds[2].revents & POLLIN) && prv_control(s) < 0)
+      return -1;
+
+    for (i = 0; i < 2; i++) {
+      if (fds[i].revents == 0)
+        continue;
+
+      rv = prv_read(i == 0 ? s : c->errs, fds[i].fd);
+      if (rv < 0)
         return -1;
-      break;
+
+      if (rv == 0)
+        fds[i].fd = -1;
     }
   }
 
   return 0;
 }
 
+/* Returns 1 if data was read, 0 on EOF and -1 on error. Lines longer than
+ * the buffer are split. */
+static int prv_read(prv_state_t *s, int fd) {
+  prv_cli_t *c = s->arg;
+  char buf[PRV_MAXBUF];
+  ssize_t n;
+  int rv;
+
+  n = read(fd, buf, sizeof(buf));
+
+  if (n < 0)
+    return (errno == EINTR || errno == EAGAIN) ? 1 : -1;
+
+  if (n == 0)
+    rv = prv_flush(s) < 0 ? -1 : 0;
+  else
+    rv = prv_feed(s, buf, n) < 0 ? -1 : 1;
+
+  /* the record file contains whole records if the process is killed */
+  if (c->record != NULL && fflush(c->record) < 0)
+    return -1;
+
+  return rv;
+}
+
 static noreturn void usage(void) {
   errx(EXIT_FAILURE,
-       "[OPTION]\n"
+       "[OPTION] [-- <command> <arg> ...]\n"
        "Pressure relief valve, version: %s (using %s mode process "
        "restriction)\n\n"
        "-s, --service <plugin>/<type>\n"
        "                          collectd service\n"
        "-H, --hostname <name>     system hostname\n"
-       "-l, --limit               message rate limit\n"
+       "-C, --control <path>      control FIFO\n"
+       "-c, --count <name>=<regex>\n"
+       "                          count matching lines (repeatable)\n"
+       "-G, --count-type <derive|gauge>\n"
+       "                          counter type (default: derive)\n"
+       "-K, --count-sample <n>    matching lines sent per rule per window\n"
+       "-A, --restart <n|always>  restart the command with backoff\n"
+       "-E, --capture-stderr      command stderr as warning notifications\n"
+       "-P, --pipe-size <bytes>   command output pipe size (default: %d)\n"
+       "-l, --limit <n>[/<period>]\n"
+       "                          message rate limit (repeatable with period)\n"
        "-w, --window              message rate window\n"
        "-W, --write-error <exit|drop|block>\n"
        "                          behaviour if write buffer is full\n"
        "-M, --max-event-length    max message fragment length\n"
        "-I, --max-event-id        max message fragment header id\n"
+       "-r, --record <path>       record input lines with timestamps\n"
+       "-R, --replay <path>       replay recorded input\n"
+       "-X, --replay-speed <n>    replay speed multiplier (0: no delay)\n"
+       "-S, --state <path>        persist rate limit state across restarts\n"
+       "-Q, --spool <path>        delay lines exceeding the limit\n"
+       "-Z, --spool-size <bytes>  spool file size (default: %d)\n"
+       "-T, --top <n>             report top flooding templates per window\n"
        "-v, --verbose             verbose mode\n"
        "-h, --help                help",
-       PRV_VERSION, RESTRICT_PROCESS);
+       PRV_VERSION, RESTRICT_PROCESS, PRV_PIPE_SIZE, PRV_SPOOL_SIZE);
 }
@@ -0,0 +1,1211 @@
+/* Copyright (c) 2017-2025, Michael Santos <michael.santos@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#ifndef HAVE_STRTONUM
+#include "strtonum.h"
+#endif
+#include "prv.h"
+#include "prv_probe.h"
+
+#ifdef CLOCK_MONOTONIC_COARSE
+#define PRV_CLOCK_MONOTONIC CLOCK_MONOTONIC_COARSE
+#else
+#define PRV_CLOCK_MONOTONIC CLOCK_MONOTONIC
+#endif
+
+#define PRV_STATE_MAGIC 0x70727673 /* prvs */
+#define PRV_STATE_VERSION 2
+
+#define PRV_SPOOL_MAGIC 0x70727671 /* prvq */
+#define PRV_SPOOL_VERSION 1
+
+static int prv_drain(prv_state_t *s, int eof);
+static int prv_output(prv_state_t *s, char *buf, size_t buflen);
+static int prv_window(prv_state_t *s, const struct timespec *t1);
+static int prv_send(prv_state_t *s, time_t t, char *buf, size_t buflen);
+static int prv_defer(prv_state_t *s, time_t t, const char *buf,
+                     size_t buflen);
+static int prv_spool_send(prv_state_t *s);
+static size_t prv_spool_frags(prv_state_t *s, const char *buf, size_t buflen);
+static void prv_spool_write(prv_spool_t *sp, uint64_t off, const void *buf,
+                            size_t n);
+static void prv_spool_read(const prv_spool_t *sp, uint64_t off, void *buf,
+                           size_t n);
+static int prv_notify(prv_state_t *s, time_t t, int severity, int offset,
+                      size_t total, const char *buf, size_t n);
+static int prv_notify_escape(const char *buf, size_t n);
+static int prv_clock_monotonic(prv_state_t *s, struct timespec *tp);
+static void prv_state_save(prv_state_t *s);
+static uint64_t prv_state_sum(const prv_state_file_t *sf);
+static void prv_state_tier_restore(prv_state_t *s,
+                                   const prv_state_file_t *sf);
+static void prv_sketch_update(prv_sketch_t *sk, const char *buf,
+                              size_t buflen);
+static size_t prv_template(const char *buf, size_t buflen, char *tmpl,
+                           size_t tmpllen, uint64_t *hash);
+static int prv_flood_report(prv_state_t *s);
+static int prv_tier_parse(const char *arg, prv_tier_t *tier);
+static void prv_tier_advance(prv_state_t *s, const struct timespec *tp);
+static prv_tier_t *prv_tier_check(prv_state_t *s, size_t n);
+static void prv_tier_charge(prv_state_t *s, size_t n);
+static int prv_count(prv_state_t *s, const char *buf);
+
+void prv_init(prv_state_t *s) {
+  (void)memset(s, 0, sizeof(prv_state_t));
+
+  s->window = 1;
+
+  /* @99:99:99@ */
+  s->maxid = 99;
+  s->maxlen = 255 - 10;
+
+  s->plugin = "stdout";
+  s->type = "prv";
+
+  s->clock = prv_clock_monotonic;
+  s->notify = prv_putnotif;
+  s->putval = prv_putval;
+}
+
+/* Allocate resources and start the rate limit window: called after the
+ * configuration is set. */
+int prv_start(prv_state_t *s) {
+  if (s->hostname[0] == '\0') {
+    if (gethostname(s->hostname, PRV_HOSTNAME_MAX_LEN - 1) < 0)
+      return -1;
+  }
+
+  if (s->top > 0 && s->sketch == NULL) {
+    s->sketch = calloc(1, sizeof(prv_sketch_t));
+    if (s->sketch == NULL)
+      return -1;
+  }
+
+  return s->clock(s, &s->t0);
+}
+
+void prv_free(prv_state_t *s) {
+  size_t i;
+
+  free(s->sketch);
+  s->sketch = NULL;
+
+  for (i = 0; i < s->nrule; i++)
+    regfree(&s->rule[i].re);
+  s->nrule = 0;
+
+  if (s->state != NULL) {
+    (void)munmap(s->state, sizeof(prv_state_file_t));
+    s->state = NULL;
+  }
+
+  if (s->spool != NULL) {
+    (void)munmap(s->spool, sizeof(prv_spool_t) + s->spool->size);
+    s->spool = NULL;
+  }
+}
+
+/* Buffer input and process complete lines. Lines longer than the buffer
+ * are split. */
+int prv_feed(prv_state_t *s, const char *buf, size_t n) {
+  size_t len;
+
+  while (n > 0) {
+    len = MIN(n, sizeof(s->buf) - 1 - s->buflen);
+
+    (void)memcpy(s->buf + s->buflen, buf, len);
+    s->buflen += len;
+    buf += len;
+    n -= len;
+
+    if (prv_drain(s, 0) < 0)
+      return -1;
+  }
+
+  return 0;
+}
+
+/* Process any buffered partial line */
+int prv_flush(prv_state_t *s) { return prv_drain(s, 1); }
+
+static int prv_drain(prv_state_t *s, int eof) {
+  size_t start = 0;
+
+  while (start < s->buflen) {
+    char *line = s->buf + start;
+    char *nl = memchr(line, '\n', s->buflen - start);
+    size_t linelen;
+    char c;
+
+    if (nl != NULL)
+      linelen = nl - line + 1;
+    else if (eof || s->buflen - start == sizeof(s->buf) - 1)
+      linelen = s->buflen - start;
+    else
+      break;
+
+    /* lines are truncated at NUL */
+    c = line[linelen];
+    line[linelen] = '\0';
+
+    if (s->input != NULL && s->input(s, line, strlen(line)) < 0)
+      return -1;
+
+    if (prv_line(s, line, strlen(line)) < 0)
+      return -1;
+
+    line[linelen] = c;
+    start += linelen;
+  }
+
+  if (start > 0) {
+    (void)memmove(s->buf, s->buf + start, s->buflen - start);
+    s->buflen -= start;
+  }
+
+  return 0;
+}
+
+int prv_line(prv_state_t *s, char *buf, size_t buflen) {
+  if (prv_output(s, buf, buflen) < 0) {
+    if (errno == EAGAIN) {
+      PRV_PROBE1(eagain, buflen);
+      VERBOSE(s, 1, "PIPE FULL:dropped:%s", buf);
+      if (s->write_error == PRV_WR_DROP)
+        return 0;
+    }
+    return -1;
+  }
+
+  return 0;
+}
+
+static int prv_output(prv_state_t *s, char *buf, size_t buflen) {
+  struct timespec t1;
+  time_t t;
+  int rv;
+
+  if (buflen == 0)
+    return 0;
+
+  s->stats.lines++;
+
+  PRV_PROBE1(line, buflen);
+
+  if (s->clock(s, &t1) < 0)
+    return -1;
+
+  if (prv_window(s, &t1) < 0)
+    return -1;
+
+  if (s->sketch != NULL)
+    prv_sketch_update(s->sketch, buf, buflen);
+
+  /* counted lines are not sent unless sampled */
+  if (s->nrule > 0 && prv_count(s, buf) == 0)
+    return 0;
+
+  t = time(NULL);
+
+  if (s->spool != NULL) {
+    rv = prv_spool_send(s);
+
+    /* preserve ordering: queue behind spooled lines. The line is also
+     * queued if the output is full or failed. */
+    if (rv != 0 || s->spool->tail != s->spool->head) {
+      int errnum = errno;
+
+      (void)prv_defer(s, t, buf, buflen);
+      errno = errnum;
+      return rv < 0 ? -1 : 0;
+    }
+  }
+
+  rv = prv_send(s, t, buf, buflen);
+  if (rv != 0)
+    return rv;
+
+  return prv_defer(s, t, buf, buflen);
+}
+
+/* Start a new rate limit window if the current window has expired */
+static int prv_window(prv_state_t *s, const struct timespec *t1) {
+  int sec;
+  int rv;
+
+  sec = t1->tv_sec - s->t0.tv_sec;
+
+  if (sec >= s->window) {
+    size_t discard = s->discard;
+    time_t now = time(NULL);
+    time_t end = now - (sec - s->window);
+
+    PRV_PROBE3(rollover, s->count, discard, s->limit);
+
+    s->count = 0;
+    s->discard = 0;
+    s->t0.tv_sec = t1->tv_sec;
+    s->t0.tv_nsec = 0;
+    prv_state_save(s);
+
+    if (s->sketch != NULL) {
+      if (discard > 0) {
+        s->discard = discard;
+        rv = prv_flood_report(s);
+        s->discard = 0;
+        if (rv < 0)
+          return -1;
+      } else {
+        (void)memset(s->sketch, 0, sizeof(prv_sketch_t));
+      }
+    }
+
+    /* counters are timestamped with the end of the window. If no lines
+     * were read for a full window, gauges drop to 0 at the end of the
+     * most recent window. */
+    if (s->nrule > 0) {
+      if (prv_count_report(s, end) < 0)
+        return -1;
+
+      if (s->count_type == PRV_COUNT_GAUGE && sec >= 2 * s->window &&
+          prv_count_report(s, now - sec % s->window) < 0)
+        return -1;
+    }
+  }
+
+  VERBOSE(s, 3, "INTERVAL:%d/%d\n", sec, s->window);
+
+  prv_tier_advance(s, t1);
+
+  return 0;
+}
+
+/* Send a line as one or more notifications. Returns 0 if the line exceeds
+ * the rate limit. */
+static int prv_send(prv_state_t *s, time_t t, char *buf, size_t buflen) {
+  size_t chunks;
+  size_t n;
+  ssize_t rem;
+  prv_tier_t *tier;
+
+  if ((s->limit > 0) && (s->count >= s->limit)) {
+    PRV_PROBE3(discard, buflen, s->count, s->limit);
+    VERBOSE(s, 2, "DISCARD:%zu/%zu:%s", s->count, s->limit, buf);
+    return 0;
+  }
+
+  /* Don't include trailing newline */
+  if (buf[buflen - 1] == '\n')
+    buflen--;
+
+  if (buflen == 0)
+    return 1;
+
+  /* number of fragments: 0 or > 0 */
+  chunks = buflen / s->maxlen;
+
+  /* length of trailing partial fragment */
+  rem = buflen % s->maxlen;
+
+  /* number of messages: 1 or > 1 */
+  n = chunks + (rem == 0 ? 0 : 1);
+
+  tier = prv_tier_check(s, n);
+  if (tier != NULL) {
+    PRV_PROBE3(discard, buflen, tier->sum, tier->limit);
+    VERBOSE(s, 2, "TIERLIMIT:count=%zu/limit=%zu/period=%us/frags=%zu:%s",
+            tier->sum, tier->limit, tier->period, n, buf);
+    return 0;
+  }
+
+  s->count += n;
+
+  if ((s->limit > 0) && (s->count > s->limit)) {
+    PRV_PROBE3(fraglimit, n, s->count, s->limit);
+    VERBOSE(s, 2, "FRAGLIMIT:count=%zu/limit=%zu/frags=%zu/rem=%zu:%s",
+            s->count, s->limit, n, rem, buf);
+    prv_state_save(s);
+    return 0;
+  }
+
+  prv_tier_charge(s, n);
+
+  if (n > 1)
+    s->frag = (s->frag % s->maxid) + 1;
+
+  /* the state file is updated once per line, before output */
+  prv_state_save(s);
+
+  PRV_PROBE3(admit, buflen, s->count, s->limit);
+
+  s->stats.emitted += n;
+  if (n > 1)
+    s->stats.fragmented++;
+
+  switch (n) {
+  case 1:
+    if (prv_notify(s, t, s->severity, 1, 1, buf, buflen) < 0)
+      return -1;
+    break;
+
+  default: {
+    size_t i;
+
+    for (i = 0; i < chunks; i++) {
+      char *frag = buf + (s->maxlen * i);
+      int fraglen = MIN(strlen(frag), s->maxlen);
+
+      PRV_PROBE3(fragment, fraglen, i + 1, n);
+      if (prv_notify(s, t, s->severity, i + 1, n, frag, fraglen) < 0)
+        return -1;
+    }
+
+    if (rem > 0) {
+      PRV_PROBE3(fragment, rem, n, n);
+      if (prv_notify(s, t, s->severity, n, n, buf + (s->maxlen * (n - 1)),
+                     rem) < 0)
+        return -1;
+    }
+  }
+
+  break;
+  }
+
+  return n;
+}
+
+static int prv_notify(prv_state_t *s, time_t t, int severity, int offset,
+                      size_t total, const char *buf, size_t n) {
+  char msg[PRV_MAXBUF + 32];
+  int len = 0;
+
+  if (total > 1) {
+    len = snprintf(msg, sizeof(msg), "@%zu:%d:%zu@", s->frag, offset, total);
+    if (len < 0)
+      return -1;
+  }
+
+  n = MIN(n, sizeof(msg) - len);
+  (void)memcpy(msg + len, buf, n);
+
+  return s->notify(s, t, severity, msg, len + n);
+}
+
+/* Write a notification to stdout using the collectd exec plugin protocol */
+int prv_putnotif(prv_state_t *s, time_t t, int severity, const char *buf,
+                 size_t n) {
+  if (fprintf(stdout,
+              "PUTNOTIF host=%s severity=%s time=%lld plugin=%s "
+              "type=%s message=\"",
+              s->hostname, prv_severity(severity), (long long)t, s->plugin,
+              s->type) < 0)
+    return -1;
+
+  if (prv_notify_escape(buf, n) < 0)
+    return -1;
+
+  if (fprintf(stdout, "\"\n") < 0)
+    return -1;
+
+  return 0;
+}
+
+const char *prv_severity(int severity) {
+  switch (severity) {
+  case PRV_SEV_WARNING:
+    return "warning";
+  case PRV_SEV_FAILURE:
+    return "failure";
+  default:
+    return "okay";
+  }
+}
+
+static int prv_notify_escape(const char *buf, size_t n) {
+  size_t i;
+
+  for (i = 0; i < n; i++) {
+    switch (buf[i]) {
+    case '"':
+      if (fprintf(stdout, "\\\"") < 0)
+        return -1;
+      break;
+    case '\\':
+      if (fprintf(stdout, "\\\\") < 0)
+        return -1;
+      break;
+    default:
+      if (fprintf(stdout, "%c", buf[i]) < 0)
+        return -1;
+      break;
+    }
+  }
+
+  return 0;
+}
+
+/* Write a counter to stdout using the collectd exec plugin protocol:
+ * <host>/<plugin>-<type>/<derive|gauge>-<name> */
+int prv_putval(prv_state_t *s, time_t t, const char *type, const char *name,
+               uint64_t value) {
+  if (fprintf(stdout, "PUTVAL \"%s/%s-%s/%s-%s\" interval=%d %lld:%llu\n",
+              s->hostname, s->plugin, s->type, type, name, s->window,
+              (long long)t, (unsigned long long)value) < 0)
+    return -1;
+
+  return 0;
+}
+
+static int prv_clock_monotonic(prv_state_t *s, struct timespec *tp) {
+  return clock_gettime(PRV_CLOCK_MONOTONIC, tp);
+}
+
+int prv_write_error(prv_state_t *s, const char *arg) {
+  if (strcmp(arg, "block") == 0)
+    s->write_error = PRV_WR_BLOCK;
+  else if (strcmp(arg, "drop") == 0)
+    s->write_error = PRV_WR_DROP;
+  else if (strcmp(arg, "exit") == 0)
+    s->write_error = PRV_WR_EXIT;
+  else
+    return -1;
+
+  return 0;
+}
+
+int prv_state_open(prv_state_t *s, const char *path) {
+  prv_state_file_t *sf;
+  struct stat sb = {0};
+  int fd;
+
+  fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  if (fd < 0)
+    return -1;
+
+  if (fstat(fd, &sb) < 0)
+    goto ERR;
+
+  /* new or truncated file: zero filled, fails validation below */
+  if (sb.st_size != sizeof(prv_state_file_t) &&
+      ftruncate(fd, sizeof(prv_state_file_t)) < 0)
+    goto ERR;
+
+  sf = mmap(NULL, sizeof(prv_state_file_t), PROT_READ | PROT_WRITE,
+            MAP_SHARED, fd, 0);
+  if (sf == MAP_FAILED)
+    goto ERR;
+
+  (void)close(fd);
+
+  /* Discard state if corrupt or stale: the monotonic clock is reset on
+   * reboot. */
+  if (sf->magic != PRV_STATE_MAGIC || sf->version != PRV_STATE_VERSION ||
+      sf->sum != prv_state_sum(sf) || sf->t0 > s->t0.tv_sec) {
+    VERBOSE(s, 1, "STATE:reset:%s\n", path);
+  } else {
+    s->t0.tv_sec = sf->t0;
+    s->t0.tv_nsec = 0;
+    s->count = sf->count;
+    s->frag = sf->frag % (s->maxid + 1);
+    VERBOSE(s, 1, "STATE:restore:count=%zu/frag=%zu\n", s->count, s->frag);
+    prv_state_tier_restore(s, sf);
+  }
+
+  s->state = sf;
+  prv_state_save(s);
+
+  return 0;
+
+ERR:
+  (void)close(fd);
+  return -1;
+}
+
+static void prv_state_save(prv_state_t *s) {
+  prv_state_file_t *sf = s->state;
+  size_t i;
+  size_t k;
+
+  if (sf == NULL)
+    return;
+
+  sf->magic = PRV_STATE_MAGIC;
+  sf->version = PRV_STATE_VERSION;
+  sf->t0 = s->t0.tv_sec;
+  sf->count = s->count;
+  sf->frag = s->frag;
+  sf->ntier = s->ntier;
+
+  for (i = 0; i < s->ntier; i++) {
+    prv_state_tier_t *st = &sf->tier[i];
+    const prv_tier_t *tier = &s->tier[i];
+
+    st->period = tier->period;
+    st->limit = tier->limit;
+    st->t = tier->t;
+    st->sum = tier->sum;
+    for (k = 0; k < PRV_TIER_BUCKETS; k++)
+      st->bucket[k] = tier->bucket[k];
+  }
+
+  sf->sum = prv_state_sum(sf);
+}
+
+/* Restore the sliding window limits if the periods are unchanged */
+static void prv_state_tier_restore(prv_state_t *s,
+                                   const prv_state_file_t *sf) {
+  size_t i;
+  size_t k;
+
+  if (sf->ntier != s->ntier)
+    goto RESET;
+
+  for (i = 0; i < s->ntier; i++) {
+    if (sf->tier[i].period != s->tier[i].period)
+      goto RESET;
+  }
+
+  for (i = 0; i < s->ntier; i++) {
+    prv_tier_t *tier = &s->tier[i];
+    const prv_state_tier_t *st = &sf->tier[i];
+
+    tier->t = st->t;
+    tier->sum = st->sum;
+    for (k = 0; k < PRV_TIER_BUCKETS; k++)
+      tier->bucket[k] = st->bucket[k];
+
+    VERBOSE(s, 1, "STATE:restore:tier=%u/sum=%zu\n", tier->period,
+            tier->sum);
+  }
+
+  return;
+
+RESET:
+  VERBOSE(s, 1, "STATE:reset:tiers\n");
+}
+
+static uint64_t prv_state_sum(const prv_state_file_t *sf) {
+  uint64_t sum = ((uint64_t)sf->magic << 32 | sf->version) ^
+                 (uint64_t)sf->t0 ^ (sf->count * 0x9e3779b97f4a7c15ULL) ^
+                 (sf->frag << 17) ^ (sf->ntier << 7);
+  size_t i;
+  size_t k;
+
+  for (i = 0; i < sf->ntier && i < PRV_TIER_MAX; i++) {
+    const prv_state_tier_t *tier = &sf->tier[i];
+
+    sum = (sum ^ ((uint64_t)tier->period << 32 | tier->limit) ^ tier->t ^
+           (tier->sum << 11)) *
+          0x100000001b3ULL;
+
+    for (k = 0; k < PRV_TIER_BUCKETS; k++)
+      sum = (sum ^ tier->bucket[k]) * 0x100000001b3ULL;
+  }
+
+  return sum;
+}
+
+static void prv_sketch_update(prv_sketch_t *sk, const char *buf,
+                              size_t buflen) {
+  prv_sketch_entry_t *e;
+  prv_sketch_entry_t *min = NULL;
+  char tmpl[PRV_TEMPLATE_LEN];
+  uint64_t hash;
+  size_t i;
+
+  (void)prv_template(buf, buflen, tmpl, sizeof(tmpl), &hash);
+
+  sk->total++;
+
+  for (i = 0; i < sk->used; i++) {
+    e = &sk->entry[i];
+    if (e->hash == hash) {
+      e->count++;
+      return;
+    }
+    if (min == NULL || e->count < min->count)
+      min = e;
+  }
+
+  if (sk->used < PRV_SKETCH_SIZE) {
+    e = &sk->entry[sk->used++];
+    e->error = 0;
+    e->count = 1;
+  } else {
+    /* evict the minimum: the new template inherits its count as error */
+    e = min;
+    e->error = e->count;
+    e->count++;
+  }
+
+  e->hash = hash;
+  (void)memcpy(e->template, tmpl, sizeof(tmpl));
+}
+
+/* Normalize a line by masking numbers, hex strings and quoted strings.
+ * Returns the template length; the template is truncated to tmpllen - 1
+ * but the hash covers the full template. */
+static size_t prv_template(const char *buf, size_t buflen, char *tmpl,
+                           size_t tmpllen, uint64_t *hash) {
+  uint64_t h = 0xcbf29ce484222325ULL; /* FNV-1a */
+  size_t n = 0;
+  size_t i = 0;
+  size_t j;
+  int digit;
+  char c;
+
+#define PRV_TEMPLATE_PUTC(__c)                                                 \
+  do {                                                                         \
+    h = (h ^ (unsigned char)(__c)) * 0x100000001b3ULL;                         \
+    if (n < tmpllen - 1)                                                       \
+      tmpl[n] = (__c);                                                         \
+    n++;                                                                       \
+  } while (0)
+
+  while (i < buflen && buf[i] != '\n') {
+    c = buf[i];
+
+    if (c == '"' || c == '\'') {
+      for (j = i + 1; j < buflen && buf[j] != c && buf[j] != '\n'; j++)
+        ;
+      if (j < buflen && buf[j] == c) {
+        PRV_TEMPLATE_PUTC(c);
+        PRV_TEMPLATE_PUTC('*');
+        PRV_TEMPLATE_PUTC(c);
+        i = j + 1;
+        continue;
+      }
+    }
+
+    if (isxdigit((unsigned char)c)) {
+      digit = 0;
+      for (j = i; j < buflen; j++) {
+        if (isdigit((unsigned char)buf[j]))
+          digit = 1;
+        else if (!isxdigit((unsigned char)buf[j]) &&
+                 !(j == i + 1 && buf[i] == '0' &&
+                   (buf[j] == 'x' || buf[j] == 'X')))
+          break;
+      }
+      if (digit) {
+        PRV_TEMPLATE_PUTC('#');
+      } else {
+        for (; i < j; i++)
+          PRV_TEMPLATE_PUTC(buf[i]);
+      }
+      i = j;
+      continue;
+    }
+
+    PRV_TEMPLATE_PUTC(c);
+    i++;
+  }
+
+#undef PRV_TEMPLATE_PUTC
+
+  tmpl[MIN(n, tmpllen - 1)] = '\0';
+  *hash = h;
+  return n;
+}
+
+static int prv_flood_report(prv_state_t *s) {
+  prv_sketch_t *sk = s->sketch;
+  prv_sketch_entry_t *top[PRV_TOP_MAX];
+  char msg[PRV_MAXBUF];
+  size_t msglen;
+  size_t ntop = 0;
+  size_t i;
+  size_t j;
+  int rv;
+
+  for (i = 0; i < sk->used; i++) {
+    prv_sketch_entry_t *e = &sk->entry[i];
+
+    /* insertion sort into the top list */
+    for (j = ntop; j > 0 && top[j - 1]->count < e->count; j--) {
+      if (j < s->top)
+        top[j] = top[j - 1];
+    }
+    if (j < s->top) {
+      top[j] = e;
+      if (ntop < s->top)
+        ntop++;
+    }
+  }
+
+  rv = snprintf(msg, sizeof(msg), "flood:lines=%zu:discarded=%zu:",
+                sk->total, s->discard);
+  msglen = MIN((size_t)rv, sizeof(msg) - 1);
+
+  for (i = 0; i < ntop && msglen < sizeof(msg) - 1; i++) {
+    rv = snprintf(msg + msglen, sizeof(msg) - msglen, "%s%zu:%s",
+                  i == 0 ? "" : "|", top[i]->count, top[i]->template);
+    msglen = MIN(msglen + rv, sizeof(msg) - 1);
+  }
+
+  VERBOSE(s, 1, "%s\n", msg);
+
+  (void)memset(sk, 0, sizeof(prv_sketch_t));
+
+  return prv_notify(s, time(NULL), PRV_SEV_WARNING, 1, 1, msg,
+                    MIN(msglen, s->maxlen));
+}
+
+/* Add a sliding window limit: <number>/<period>. A limit with the same
+ * period as an existing limit replaces the limit, keeping the counts. */
+int prv_tier_add(prv_state_t *s, const char *arg) {
+  prv_tier_t t = {0};
+  size_t i;
+
+  if (prv_tier_parse(arg, &t) < 0)
+    return -1;
+
+  for (i = 0; i < s->ntier; i++) {
+    if (s->tier[i].period == t.period) {
+      s->tier[i].limit = t.limit;
+      return 0;
+    }
+  }
+
+  if (s->ntier >= PRV_TIER_MAX)
+    return -1;
+
+  s->tier[s->ntier++] = t;
+
+  return 0;
+}
+
+/* Parse a limit in the format: <number>/<period>[s|m|h|d] */
+static int prv_tier_parse(const char *arg, prv_tier_t *tier) {
+  char buf[32];
+  char *p;
+  size_t len;
+  int scale = 1;
+  const char *errstr = NULL;
+
+  if (strlen(arg) >= sizeof(buf))
+    return -1;
+
+  (void)memcpy(buf, arg, strlen(arg) + 1);
+
+  p = strchr(buf, '/');
+  if (p == NULL)
+    return -1;
+
+  *p++ = '\0';
+
+  len = strlen(p);
+  if (len == 0)
+    return -1;
+
+  switch (p[len - 1]) {
+  case 's':
+    break;
+  case 'm':
+    scale = 60;
+    break;
+  case 'h':
+    scale = 60 * 60;
+    break;
+  case 'd':
+    scale = 24 * 60 * 60;
+    break;
+  default:
+    len++;
+    break;
+  }
+
+  p[len - 1] = '\0';
+
+  tier->limit = strtonum(buf, 1, 0xffffff, &errstr);
+  if (errstr != NULL)
+    return -1;
+
+  /* unit only: 1 second, minute, ... */
+  if (*p == '\0') {
+    tier->period = scale;
+  } else {
+    tier->period = strtonum(p, 1, 0xffffff / scale, &errstr);
+    if (errstr != NULL)
+      return -1;
+    tier->period *= scale;
+  }
+
+  tier->width = (uint64_t)tier->period * 1000 / PRV_TIER_BUCKETS;
+
+  return 0;
+}
+
+/* Expire buckets older than the period: at most PRV_TIER_BUCKETS per
+ * tier. */
+static void prv_tier_advance(prv_state_t *s, const struct timespec *tp) {
+  uint64_t ms = (uint64_t)tp->tv_sec * 1000 + tp->tv_nsec / 1000000;
+  size_t i;
+
+  for (i = 0; i < s->ntier; i++) {
+    prv_tier_t *tier = &s->tier[i];
+    uint64_t t = ms / tier->width;
+    uint64_t k;
+
+    for (k = 0; tier->t < t && k < PRV_TIER_BUCKETS; k++) {
+      size_t *b = &tier->bucket[(tier->t + 1 + k) % PRV_TIER_BUCKETS];
+
+      tier->sum -= *b;
+      *b = 0;
+      if (tier->t + 1 + k == t)
+        break;
+    }
+
+    tier->t = t;
+  }
+}
+
+/* Returns the first tier without capacity for n messages or NULL */
+static prv_tier_t *prv_tier_check(prv_state_t *s, size_t n) {
+  size_t i;
+
+  for (i = 0; i < s->ntier; i++) {
+    if (s->tier[i].sum + n > s->tier[i].limit)
+      return &s->tier[i];
+  }
+
+  return NULL;
+}
+
+static void prv_tier_charge(prv_state_t *s, size_t n) {
+  size_t i;
+
+  for (i = 0; i < s->ntier; i++) {
+    s->tier[i].bucket[s->tier[i].t % PRV_TIER_BUCKETS] += n;
+    s->tier[i].sum += n;
+  }
+}
+
+/* Add a count rule: <name>=<extended regular expression> */
+int prv_rule_add(prv_state_t *s, const char *arg) {
+  prv_rule_t *rule;
+  const char *p;
+  size_t len;
+  size_t i;
+
+  if (s->nrule >= PRV_RULE_MAX)
+    goto ERR;
+
+  p = strchr(arg, '=');
+  if (p == NULL)
+    goto ERR;
+
+  len = p - arg;
+  if (len == 0 || len >= PRV_DATA_MAX_LEN)
+    goto ERR;
+
+  /* the name is used as the collectd type instance */
+  for (i = 0; i < len; i++) {
+    if (!isalnum((unsigned char)arg[i]) && arg[i] != '_' && arg[i] != '.')
+      goto ERR;
+  }
+
+  rule = &s->rule[s->nrule];
+  (void)memset(rule, 0, sizeof(prv_rule_t));
+  (void)memcpy(rule->name, arg, len);
+
+  if (regcomp(&rule->re, p + 1, REG_EXTENDED | REG_NOSUB | REG_NEWLINE) != 0)
+    goto ERR;
+
+  s->nrule++;
+  return 0;
+
+ERR:
+  errno = EINVAL;
+  return -1;
+}
+
+int prv_count_type(prv_state_t *s, const char *arg) {
+  if (strcmp(arg, "derive") == 0)
+    s->count_type = PRV_COUNT_DERIVE;
+  else if (strcmp(arg, "gauge") == 0)
+    s->count_type = PRV_COUNT_GAUGE;
+  else
+    return -1;
+
+  return 0;
+}
+
+/* Returns 1 if the line should be sent as a notification. Lines not
+ * matching any rule are discarded. */
+static int prv_count(prv_state_t *s, const char *buf) {
+  int match = 0;
+  int pass = 0;
+  size_t i;
+
+  for (i = 0; i < s->nrule; i++) {
+    prv_rule_t *rule = &s->rule[i];
+
+    if (regexec(&rule->re, buf, 0, NULL, 0) != 0)
+      continue;
+
+    match = 1;
+    rule->count++;
+
+    if (rule->sampled < s->sample) {
+      rule->sampled++;
+      pass = 1;
+    }
+  }
+
+  if (match)
+    VERBOSE(s, 3, "COUNT:%s:%s", pass ? "sample" : "match", buf);
+
+  return pass;
+}
+
+/* Output the counters: called at window rollover and before exiting.
+ * Derive counters are cumulative, gauges are the count for the window. */
+int prv_count_report(prv_state_t *s, time_t t) {
+  const char *type = s->count_type == PRV_COUNT_GAUGE ? "gauge" : "derive";
+  size_t i;
+
+  /* collectd ignores values which are not newer than the previous value:
+   * a report in the same second as the rollover is sent 1 second later */
+  if (t <= s->count_t)
+    t = s->count_t + 1;
+
+  s->count_t = t;
+
+  for (i = 0; i < s->nrule; i++) {
+    prv_rule_t *rule = &s->rule[i];
+
+    if (s->putval(s, t, type, rule->name, rule->count) < 0)
+      return -1;
+
+    if (s->count_type == PRV_COUNT_GAUGE)
+      rule->count = 0;
+
+    rule->sampled = 0;
+  }
+
+  return 0;
+}
+
+/* Open the deferred delivery spool: a ring buffer of lines exceeding the
+ * rate limit, memory mapped from a fixed size file. The file is not
+ * synced: the contents survive a restart but not a crash of the system. */
+int prv_spool_open(prv_state_t *s, const char *path, size_t size) {
+  prv_spool_t *sp;
+  struct stat sb = {0};
+  size_t len = sizeof(prv_spool_t) + size;
+  int fd;
+
+  fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  if (fd < 0)
+    return -1;
+
+  if (fstat(fd, &sb) < 0)
+    goto ERR;
+
+  if ((size_t)sb.st_size != len && ftruncate(fd, len) < 0)
+    goto ERR;
+
+  sp = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (sp == MAP_FAILED)
+    goto ERR;
+
+  (void)close(fd);
+
+  if (sp->magic != PRV_SPOOL_MAGIC || sp->version != PRV_SPOOL_VERSION ||
+      sp->size != size || sp->head > sp->tail ||
+      sp->tail - sp->head > size) {
+    VERBOSE(s, 1, "SPOOL:reset:%s\n", path);
+    sp->magic = PRV_SPOOL_MAGIC;
+    sp->version = PRV_SPOOL_VERSION;
+    sp->size = size;
+    sp->head = 0;
+    sp->tail = 0;
+    sp->records = 0;
+  } else {
+    VERBOSE(s, 1, "SPOOL:restore:records=%llu/bytes=%llu\n",
+            (unsigned long long)sp->records,
+            (unsigned long long)(sp->tail - sp->head));
+  }
+
+  s->spool = sp;
+
+  return 0;
+
+ERR:
+  (void)close(fd);
+  return -1;
+}
+
+/* Roll over the rate limit window if it has expired, reporting counters,
+ * and send spooled lines: called periodically if no input is available. */
+int prv_tick(prv_state_t *s) {
+  struct timespec t1;
+
+  if (s->clock(s, &t1) < 0)
+    return -1;
+
+  if (prv_window(s, &t1) < 0)
+    return -1;
+
+  if (s->spool == NULL)
+    return 0;
+
+  return prv_spool_send(s) < 0 ? -1 : 0;
+}
+
+/* Send spooled lines in order with their original timestamps until the
+ * spool is empty or the rate limit is reached. Returns 1 if the output is
+ * full and lines are being dropped (--write-error=drop). */
+static int prv_spool_send(prv_state_t *s) {
+  prv_spool_t *sp = s->spool;
+  prv_spool_record_t r;
+  char buf[PRV_MAXBUF];
+  size_t n;
+  int rv;
+
+  while (sp->head != sp->tail) {
+    prv_spool_read(sp, sp->head, &r, sizeof(r));
+
+    if (r.len == 0 || r.len >= sizeof(buf) ||
+        sizeof(r) + r.len > sp->tail - sp->head) {
+      VERBOSE(s, 1, "SPOOL:corrupt:discarding %llu records\n",
+              (unsigned long long)sp->records);
+      sp->head = sp->tail;
+      sp->records = 0;
+      return 0;
+    }
+
+    prv_spool_read(sp, sp->head + sizeof(r), buf, r.len);
+    buf[r.len] = '\0';
+
+    /* the limits were lowered: the line would never be sent */
+    n = prv_spool_frags(s, buf, r.len);
+    if (n == 0) {
+      VERBOSE(s, 2, "SPOOL:discard:%s", buf);
+      sp->head += sizeof(r) + r.len;
+      sp->records--;
+      s->discard++;
+      s->stats.discarded++;
+      continue;
+    }
+
+    /* wait for capacity: the line is not counted until it is sent */
+    if ((s->limit > 0 && s->count + n > s->limit) ||
+        prv_tier_check(s, n) != NULL)
+      return 0;
+
+    rv = prv_send(s, (time_t)r.t, buf, r.len);
+
+    /* the line is removed even if the output failed: a partially written
+     * line is not sent again with a new fragment id */
+    sp->head += sizeof(r) + r.len;
+    sp->records--;
+
+    if (rv < 0) {
+      if (errno == EAGAIN && s->write_error == PRV_WR_DROP) {
+        VERBOSE(s, 1, "PIPE FULL:dropped:%s", buf);
+        return 1;
+      }
+      return -1;
+    }
+
+    VERBOSE(s, 2, "UNSPOOL:%s", buf);
+  }
+
+  return 0;
+}
+
+/* Returns the number of notifications needed to send a line or 0 if the
+ * line has more fragments than a limit and would never be sent */
+static size_t prv_spool_frags(prv_state_t *s, const char *buf, size_t buflen) {
+  size_t n;
+  size_t i;
+
+  if (buflen > 0 && buf[buflen - 1] == '\n')
+    buflen--;
+
+  n = (buflen + s->maxlen - 1) / s->maxlen;
+
+  if (s->limit > 0 && n > s->limit)
+    return 0;
+
+  for (i = 0; i < s->ntier; i++) {
+    if (n > s->tier[i].limit)
+      return 0;
+  }
+
+  return n;
+}
+
+/* Append a line exceeding the rate limit to the spool. If the spool is
+ * full or not enabled, the line is discarded. */
+static int prv_defer(prv_state_t *s, time_t t, const char *buf,
+                     size_t buflen) {
+  prv_spool_t *sp = s->spool;
+  prv_spool_record_t r = {.len = buflen, .t = t};
+
+  if (sp != NULL && prv_spool_frags(s, buf, buflen) > 0 &&
+      buflen < PRV_MAXBUF &&
+      sp->size - (sp->tail - sp->head) >= sizeof(r) + buflen) {
+    prv_spool_write(sp, sp->tail, &r, sizeof(r));
+    prv_spool_write(sp, sp->tail + sizeof(r), buf, buflen);
+    sp->tail += sizeof(r) + buflen;
+    sp->records++;
+    s->stats.spooled++;
+    PRV_PROBE1(spool, buflen);
+    VERBOSE(s, 2, "SPOOL:records=%llu:%s", (unsigned long long)sp->records,
+            buf);
+    return 0;
+  }
+
+  if (s->spool != NULL)
+    VERBOSE(s, 2, "SPOOL:discard:%zu\n", buflen);
+
+  s->discard++;
+  s->stats.discarded++;
+  return 0;
+}
+
+static void prv_spool_write(prv_spool_t *sp, uint64_t off, const void *buf,
+                            size_t n) {
+  size_t pos = off % sp->size;
+  size_t len = MIN(n, sp->size - pos);
+
+  (void)memcpy(sp->data + pos, buf, len);
+  (void)memcpy(sp->data, (const char *)buf + len, n - len);
+}
+
+static void prv_spool_read(const prv_spool_t *sp, uint64_t off, void *buf,
+                           size_t n) {
+  size_t pos = off % sp->size;
+  size_t len = MIN(n, sp->size - pos);
+
+  (void)memcpy(buf, sp->data + pos, len);
+  (void)memcpy((char *)buf + len, sp->data, n - len);
+}
@@ -0,0 +1,224 @@
+/* Copyright (c) 2017-2025, Michael Santos <michael.santos@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* libprv: rate limiting, fragmentation and formatting of lines as collectd
+ * notifications.
+ *
+ *   prv_state_t s;
+ *
+ *   prv_init(&s);
+ *   s.limit = 30;
+ *   s.notify = callback;
+ *   if (prv_start(&s) < 0) ...
+ *
+ *   while (...)
+ *     if (prv_feed(&s, buf, n) < 0) ...
+ *
+ *   prv_flush(&s);
+ *   prv_free(&s);
+ */
+#ifndef PRV_H
+#define PRV_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <regex.h>
+#include <time.h>
+
+#define PRV_VERSION "1.0.2"
+
+#ifndef PRV_MAXBUF
+#define PRV_MAXBUF 8192
+#endif
+
+#define PRV_DATA_MAX_LEN 64
+#define PRV_HOSTNAME_MAX_LEN 16
+
+/* flood analysis: number of sketch counters and stored template length */
+#define PRV_SKETCH_SIZE 64
+#define PRV_TEMPLATE_LEN 64
+#define PRV_TOP_MAX 16
+
+/* sliding window rate limits: max number of tiers and buckets per tier */
+#define PRV_TIER_MAX 4
+#define PRV_TIER_BUCKETS 16
+
+/* count mode: max number of pattern rules */
+#define PRV_RULE_MAX 16
+
+enum { PRV_WR_BLOCK = 0, PRV_WR_DROP, PRV_WR_EXIT };
+
+enum { PRV_COUNT_DERIVE = 0, PRV_COUNT_GAUGE };
+
+enum { PRV_SEV_OKAY = 0, PRV_SEV_WARNING, PRV_SEV_FAILURE };
+
+#define VERBOSE(__s, __n, ...)                                                 \
+  do {                                                                         \
+    if (__s->verbose >= __n) {                                                 \
+      (void)fprintf(stderr, __VA_ARGS__);                                      \
+    }                                                                          \
+  } while (0)
+
+/* sliding window limit in the state file */
+typedef struct {
+  uint32_t period;
+  uint32_t limit;
+  uint64_t t;
+  uint64_t sum;
+  uint64_t bucket[PRV_TIER_BUCKETS];
+} prv_state_tier_t;
+
+/* fixed layout of the persistent state file */
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  int64_t t0;
+  uint64_t count;
+  uint64_t frag;
+  uint64_t sum;
+  uint64_t ntier;
+  prv_state_tier_t tier[PRV_TIER_MAX];
+} prv_state_file_t;
+
+typedef struct {
+  uint64_t hash;
+  size_t count;
+  size_t error;
+  char template[PRV_TEMPLATE_LEN];
+} prv_sketch_entry_t;
+
+/* Space-Saving top-k sketch of line templates */
+typedef struct {
+  size_t total;
+  size_t used;
+  prv_sketch_entry_t entry[PRV_SKETCH_SIZE];
+} prv_sketch_t;
+
+/* sliding window limit: a ring of sub-bucket counters covering period */
+typedef struct {
+  size_t limit;
+  uint32_t period;
+  uint64_t width;
+  uint64_t t;
+  size_t sum;
+  size_t bucket[PRV_TIER_BUCKETS];
+} prv_tier_t;
+
+/* count mode: lines matching the pattern increment the counter */
+typedef struct {
+  char name[PRV_DATA_MAX_LEN];
+  regex_t re;
+  uint64_t count;
+  size_t sampled;
+} prv_rule_t;
+
+/* deferred delivery: memory mapped ring buffer of lines. head and tail
+ * are byte offsets into data which increase monotonically. */
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t size;
+  uint64_t head;
+  uint64_t tail;
+  uint64_t records;
+  char data[];
+} prv_spool_t;
+
+/* spool record header: followed by the line */
+typedef struct {
+  uint32_t len;
+  int64_t t;
+} prv_spool_record_t;
+
+typedef struct {
+  size_t lines;
+  size_t emitted;
+  size_t discarded;
+  size_t fragmented;
+  size_t spooled;
+} prv_stats_t;
+
+typedef struct prv_state prv_state_t;
+
+struct prv_state {
+  int verbose;
+  size_t limit;
+  size_t count;
+  size_t discard;
+  size_t ntier;
+  prv_tier_t tier[PRV_TIER_MAX];
+  size_t frag;
+  int window;
+  struct timespec t0;
+  char hostname[PRV_HOSTNAME_MAX_LEN];
+  char *plugin;
+  char *type;
+  int severity; /* input lines (default: PRV_SEV_OKAY) */
+  size_t maxlen;
+  size_t maxid;
+  int write_error;
+  prv_state_file_t *state;
+  prv_spool_t *spool;
+  size_t top;
+  prv_sketch_t *sketch;
+  prv_stats_t stats;
+  size_t nrule;
+  prv_rule_t rule[PRV_RULE_MAX];
+  int count_type;
+  size_t sample;
+  time_t count_t; /* time of the last counter report */
+
+  /* monotonic clock: defaults to clock_gettime(CLOCK_MONOTONIC) */
+  int (*clock)(prv_state_t *s, struct timespec *tp);
+  /* output a notification: defaults to prv_putnotif() */
+  int (*notify)(prv_state_t *s, time_t t, int severity, const char *buf,
+                size_t n);
+  /* output a counter: defaults to prv_putval() */
+  int (*putval)(prv_state_t *s, time_t t, const char *type, const char *name,
+                uint64_t value);
+  /* optional: called for each line read by prv_feed() */
+  int (*input)(prv_state_t *s, const char *buf, size_t n);
+  void *arg;
+
+  /* prv_feed() line buffer */
+  char buf[PRV_MAXBUF];
+  size_t buflen;
+};
+
+void prv_init(prv_state_t *s);
+int prv_start(prv_state_t *s);
+void prv_free(prv_state_t *s);
+
+int prv_feed(prv_state_t *s, const char *buf, size_t n);
+int prv_flush(prv_state_t *s);
+int prv_line(prv_state_t *s, char *buf, size_t buflen);
+int prv_tick(prv_state_t *s);
+
+int prv_tier_add(prv_state_t *s, const char *arg);
+int prv_rule_add(prv_state_t *s, const char *arg);
+int prv_count_type(prv_state_t *s, const char *arg);
+int prv_count_report(prv_state_t *s, time_t t);
+int prv_write_error(prv_state_t *s, const char *arg);
+int prv_state_open(prv_state_t *s, const char *path);
+int prv_spool_open(prv_state_t *s, const char *path, size_t size);
+
+int prv_putnotif(prv_state_t *s, time_t t, int severity, const char *buf,
+                 size_t n);
+const char *prv_severity(int severity);
+int prv_putval(prv_state_t *s, time_t t, const char *type, const char *name,
+               uint64_t value);
+
+#endif
@@ -0,0 +1,314 @@
+/* Copyright (c) 2017-2025, Michael Santos <michael.santos@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* collectd plugin: tail files and dispatch lines as notifications
+ *
+ * LoadPlugin prv
+ * <Plugin prv>
+ *   File "/var/log/syslog"
+ *   Service "tail/syslog"
+ *   Limit "30/s"
+ * </Plugin>
+ */
+#include "collectd.h"
+#include "plugin.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifndef HAVE_STRTONUM
+#include "strtonum.h"
+#endif
+#include "prv.h"
+
+typedef struct {
+  char *path;
+  int fd;
+  dev_t dev;
+  ino_t ino;
+  off_t off;
+  prv_state_t s;
+} prv_file_t;
+
+static const char *config_keys[] = {
+    "File",   "Service",        "Hostname",   "Limit",        "Window",
+    "Top",    "MaxEventLength", "MaxEventId", "FromBeginning"};
+
+static prv_file_t *files;
+static size_t nfiles;
+
+/* settings applied to all files */
+static prv_state_t config;
+static char plugin[PRV_DATA_MAX_LEN];
+static char type[PRV_DATA_MAX_LEN];
+static int from_beginning;
+
+static int prv_plugin_config(const char *key, const char *val);
+static int prv_plugin_init(void);
+static int prv_plugin_read(void);
+static int prv_plugin_shutdown(void);
+static int prv_plugin_open(prv_file_t *f, int start);
+static int prv_plugin_tail(prv_file_t *f);
+static int prv_plugin_notify(prv_state_t *s, time_t t, int severity,
+                             const char *buf, size_t n);
+
+void module_register(void) {
+  prv_init(&config);
+
+  plugin_register_config("prv", prv_plugin_config, config_keys,
+                         sizeof(config_keys) / sizeof(config_keys[0]));
+  plugin_register_init("prv", prv_plugin_init);
+  plugin_register_read("prv", prv_plugin_read);
+  plugin_register_shutdown("prv", prv_plugin_shutdown);
+}
+
+static int prv_plugin_config(const char *key, const char *val) {
+  const char *errstr = NULL;
+  const char *p;
+
+  if (strcasecmp(key, "File") == 0) {
+    prv_file_t *f;
+
+    f = realloc(files, (nfiles + 1) * sizeof(prv_file_t));
+    if (f == NULL)
+      return -1;
+
+    files = f;
+    f = &files[nfiles];
+
+    (void)memset(f, 0, sizeof(prv_file_t));
+    f->fd = -1;
+    f->path = strdup(val);
+    if (f->path == NULL)
+      return -1;
+
+    nfiles++;
+  } else if (strcasecmp(key, "Service") == 0) {
+    p = strchr(val, '/');
+    if (p == NULL || (size_t)(p - val) >= sizeof(plugin) ||
+        strlen(p + 1) >= sizeof(type)) {
+      ERROR("prv plugin: invalid format: <plugin>/<type>: %s", val);
+      return -1;
+    }
+    (void)memcpy(plugin, val, p - val);
+    plugin[p - val] = '\0';
+    (void)memcpy(type, p + 1, strlen(p + 1) + 1);
+  } else if (strcasecmp(key, "Hostname") == 0) {
+    if (strlen(val) >= PRV_HOSTNAME_MAX_LEN) {
+      ERROR("prv plugin: invalid hostname: %s", val);
+      return -1;
+    }
+    (void)memcpy(config.hostname, val, strlen(val) + 1);
+  } else if (strcasecmp(key, "Limit") == 0) {
+    if (strchr(val, '/') != NULL) {
+      if (prv_tier_add(&config, val) < 0) {
+        ERROR("prv plugin: invalid limit: <number>/<period>: %s", val);
+        return -1;
+      }
+      return 0;
+    }
+    config.limit = strtonum(val, 0, 0xffff, &errstr);
+  } else if (strcasecmp(key, "Window") == 0) {
+    config.window = strtonum(val, 1, 0xffff, &errstr);
+  } else if (strcasecmp(key, "Top") == 0) {
+    config.top = strtonum(val, 0, PRV_TOP_MAX, &errstr);
+  } else if (strcasecmp(key, "MaxEventLength") == 0) {
+    config.maxlen = strtonum(val, 1, 0xffff, &errstr);
+  } else if (strcasecmp(key, "MaxEventId") == 0) {
+    config.maxid = strtonum(val, 1, 0xffff, &errstr);
+  } else if (strcasecmp(key, "FromBeginning") == 0) {
+    from_beginning = (strcasecmp(val, "true") == 0);
+  } else {
+    return -1;
+  }
+
+  if (errstr != NULL) {
+    ERROR("prv plugin: %s: %s: %s", key, val, errstr);
+    return -1;
+  }
+
+  return 0;
+}
+
+static int prv_plugin_init(void) {
+  size_t i;
+
+  if (plugin[0] != '\0') {
+    config.plugin = plugin;
+    config.type = type;
+  } else {
+    config.plugin = "tail";
+    config.type = "prv";
+  }
+
+  config.notify = prv_plugin_notify;
+
+  for (i = 0; i < nfiles; i++) {
+    prv_file_t *f = &files[i];
+
+    f->s = config;
+    f->s.arg = f;
+
+    if (prv_start(&f->s) < 0) {
+      ERROR("prv plugin: %s: %s", f->path, strerror(errno));
+      return -1;
+    }
+
+    /* like tail -F: a missing file is opened when it is created */
+    (void)prv_plugin_open(f, from_beginning);
+  }
+
+  return 0;
+}
+
+static int prv_plugin_read(void) {
+  size_t i;
+
+  for (i = 0; i < nfiles; i++) {
+    if (prv_plugin_tail(&files[i]) < 0)
+      ERROR("prv plugin: %s: %s", files[i].path, strerror(errno));
+  }
+
+  return 0;
+}
+
+static int prv_plugin_shutdown(void) {
+  size_t i;
+
+  for (i = 0; i < nfiles; i++) {
+    if (files[i].fd >= 0)
+      (void)close(files[i].fd);
+    prv_free(&files[i].s);
+    free(files[i].path);
+  }
+
+  free(files);
+  files = NULL;
+  nfiles = 0;
+
+  return 0;
+}
+
+static int prv_plugin_open(prv_file_t *f, int start) {
+  struct stat sb = {0};
+
+  f->fd = open(f->path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+  if (f->fd < 0)
+    return -1;
+
+  if (fstat(f->fd, &sb) < 0) {
+    (void)close(f->fd);
+    f->fd = -1;
+    return -1;
+  }
+
+  f->dev = sb.st_dev;
+  f->ino = sb.st_ino;
+  f->off = start ? 0 : sb.st_size;
+
+  if (lseek(f->fd, f->off, SEEK_SET) < 0) {
+    (void)close(f->fd);
+    f->fd = -1;
+    return -1;
+  }
+
+  return 0;
+}
+
+/* Read lines appended since the last interval, following rotation and
+ * truncation. */
+static int prv_plugin_tail(prv_file_t *f) {
+  char buf[PRV_MAXBUF];
+  struct stat sb = {0};
+  ssize_t n;
+
+  if (f->fd < 0) {
+    if (prv_plugin_open(f, 1) < 0)
+      return errno == ENOENT ? 0 : -1;
+  }
+
+  for (;;) {
+    n = read(f->fd, buf, sizeof(buf));
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      if (errno == EAGAIN)
+        break;
+      return -1;
+    }
+
+    if (n == 0)
+      break;
+
+    f->off += n;
+
+    if (prv_feed(&f->s, buf, n) < 0)
+      return -1;
+  }
+
+  if (stat(f->path, &sb) < 0)
+    return errno == ENOENT ? 0 : -1;
+
+  /* rotated: the old file has been read to the end */
+  if (sb.st_dev != f->dev || sb.st_ino != f->ino) {
+    (void)prv_flush(&f->s);
+    (void)close(f->fd);
+    if (prv_plugin_open(f, 1) < 0)
+      return -1;
+    return prv_plugin_tail(f);
+  }
+
+  /* truncated */
+  if (sb.st_size < f->off) {
+    f->off = 0;
+    if (lseek(f->fd, 0, SEEK_SET) < 0)
+      return -1;
+  }
+
+  return 0;
+}
+
+static int prv_plugin_notify(prv_state_t *s, time_t t, int severity,
+                             const char *buf, size_t n) {
+  notification_t notif = {0};
+
+  switch (severity) {
+  case PRV_SEV_WARNING:
+    notif.severity = NOTIF_WARNING;
+    break;
+  case PRV_SEV_FAILURE:
+    notif.severity = NOTIF_FAILURE;
+    break;
+  default:
+    notif.severity = NOTIF_OKAY;
+    break;
+  }
+
+  notif.time = TIME_T_TO_CDTIME_T(t);
+
+  n = n < sizeof(notif.message) ? n : sizeof(notif.message) - 1;
+  (void)memcpy(notif.message, buf, n);
+
+  (void)snprintf(notif.host, sizeof(notif.host), "%s", s->hostname);
+  (void)snprintf(notif.plugin, sizeof(notif.plugin), "%s", s->plugin);
+  (void)snprintf(notif.type, sizeof(notif.type), "%s", s->type);
+
+  return plugin_dispatch_notification(&notif);
+}
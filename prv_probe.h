@@ -0,0 +1,43 @@
+/* Copyright (c) 2017-2025, Michael Santos <michael.santos@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* USDT static tracepoints: enabled if sys/sdt.h is available.
+ *
+ * Disable using -DPRV_USDT=0 or force using -DPRV_USDT=1.
+ *
+ * bpftrace -l 'usdt:./collectd-prv:collectd_prv:*'
+ */
+#ifndef PRV_USDT
+#if defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#define PRV_USDT 1
+#endif
+#endif
+#endif
+
+#if defined(PRV_USDT) && PRV_USDT
+#include <sys/sdt.h>
+
+#define PRV_PROBE1(__name, __a) DTRACE_PROBE1(collectd_prv, __name, __a)
+#define PRV_PROBE3(__name, __a, __b, __c)                                      \
+  DTRACE_PROBE3(collectd_prv, __name, __a, __b, __c)
+#else
+#define PRV_PROBE1(__name, __a)                                                \
+  do {                                                                         \
+  } while (0)
+#define PRV_PROBE3(__name, __a, __b, __c)                                      \
+  do {                                                                         \
+  } while (0)
+#endif
@@ -13,5 +13,14 @@
  * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
+#include <stddef.h>
+
 int restrict_process_init(void);
-int restrict_process_stdin(void);
+/* supervisor mode: the process spawning the command. Restrictions are
+ * inherited by the command so most methods do nothing. */
+int restrict_process_supervisor(void);
+/* fd: additional descriptors (record/replay files) kept open */
+int restrict_process_stdin(const int *fd, size_t nfd);
+
+/* rlimit, capsicum: set RLIMIT_FSIZE unless output goes to a file */
+int restrict_process_fsize(const int *fd, size_t nfd);
@@ -23,30 +23,39 @@
 #include <unistd.h>
 
 #include <errno.h>
+#include <fcntl.h>
+
+static void restrict_process_closefrom(const int *fd, size_t nfd);
 
 int restrict_process_init(void) {
   struct rlimit rl = {0};
-  struct stat sb = {0};
-
-  if (fstat(STDOUT_FILENO, &sb) < 0)
-    return -1;
-
-  if (!S_ISREG(sb.st_mode)) {
-    if (setrlimit(RLIMIT_FSIZE, &rl) < 0)
-      return -1;
-  }
 
   return setrlimit(RLIMIT_NPROC, &rl);
 }
 
-int restrict_process_stdin(void) {
+/* capability mode does not allow exec */
+int restrict_process_supervisor(void) { return 0; }
+
+int restrict_process_stdin(const int *fd, size_t nfd) {
   cap_rights_t policy_read;
   cap_rights_t policy_write;
+  cap_rights_t policy_fd;
+  size_t i;
+
+  if (restrict_process_fsize(fd, nfd) < 0)
+    return -1;
 
-  closefrom(STDERR_FILENO + 1);
+  restrict_process_closefrom(fd, nfd);
 
   (void)cap_rights_init(&policy_read, CAP_READ, CAP_EVENT);
-  (void)cap_rights_init(&policy_write, CAP_WRITE, CAP_READ);
+  (void)cap_rights_init(&policy_write, CAP_WRITE, CAP_READ, CAP_FCNTL);
+  (void)cap_rights_init(&policy_fd, CAP_READ, CAP_WRITE, CAP_EVENT,
+                        CAP_FSTAT);
+
+  for (i = 0; i < nfd; i++) {
+    if (cap_rights_limit(fd[i], &policy_fd) < 0)
+      return -1;
+  }
 
   if (cap_rights_limit(STDIN_FILENO, &policy_read) < 0)
     return -1;
@@ -59,4 +68,25 @@ int restrict_process_stdin(void) {
 
   return cap_enter();
 }
+
+/* close all descriptors except stdio and the descriptors in fd */
+static void restrict_process_closefrom(const int *fd, size_t nfd) {
+  int maxfd = STDERR_FILENO;
+  int n;
+  size_t i;
+
+  for (i = 0; i < nfd; i++)
+    maxfd = MAX(maxfd, fd[i]);
+
+  for (n = STDERR_FILENO + 1; n < maxfd; n++) {
+    for (i = 0; i < nfd; i++) {
+      if (fd[i] == n)
+        break;
+    }
+    if (i == nfd)
+      (void)close(n);
+  }
+
+  closefrom(maxfd + 1);
+}
 #endif
@@ -0,0 +1,59 @@
+/* Copyright (c) 2017-2025, Michael Santos <michael.santos@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "restrict_process.h"
+#if defined(RESTRICT_PROCESS_rlimit) || defined(RESTRICT_PROCESS_capsicum)
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/* Prevent files from being written: called after the state and spool
+ * files have been sized. Skipped if stdout, stderr or a descriptor in fd
+ * is a regular file opened for writing. */
+int restrict_process_fsize(const int *fd, size_t nfd) {
+  struct rlimit rl_zero = {0};
+  struct stat sb = {0};
+  size_t i;
+  int flags;
+
+  if (fstat(STDOUT_FILENO, &sb) < 0)
+    return -1;
+
+  if (S_ISREG(sb.st_mode))
+    return 0;
+
+  if (fstat(STDERR_FILENO, &sb) < 0)
+    return -1;
+
+  if (S_ISREG(sb.st_mode))
+    return 0;
+
+  for (i = 0; i < nfd; i++) {
+    if (fstat(fd[i], &sb) < 0)
+      return -1;
+
+    flags = fcntl(fd[i], F_GETFL);
+    if (flags < 0)
+      return -1;
+
+    if (S_ISREG(sb.st_mode) && (flags & O_ACCMODE) != O_RDONLY)
+      return 0;
+  }
+
+  return setrlimit(RLIMIT_FSIZE, &rl_zero);
+}
+#endif
@@ -16,5 +16,7 @@
 #ifdef RESTRICT_PROCESS_null
 int restrict_process_init(void) { return 0; }
 
-int restrict_process_stdin(void) { return 0; }
+int restrict_process_supervisor(void) { return 0; }
+
+int restrict_process_stdin(const int *fd, size_t nfd) { return 0; }
 #endif
@@ -16,7 +16,16 @@
 #ifdef RESTRICT_PROCESS_pledge
 #include <unistd.h>
 
-int restrict_process_init(void) { return pledge("stdio rpath", NULL); }
+int restrict_process_init(void) {
+  return pledge("stdio rpath wpath cpath dpath", NULL);
+}
 
-int restrict_process_stdin(void) { return pledge("stdio", NULL); }
+/* the command is not pledged: execpromises are NULL */
+int restrict_process_supervisor(void) {
+  return pledge("stdio proc exec", NULL);
+}
+
+int restrict_process_stdin(const int *fd, size_t nfd) {
+  return pledge("stdio", NULL);
+}
 #endif
@@ -15,29 +15,26 @@
 #include "restrict_process.h"
 #ifdef RESTRICT_PROCESS_rlimit
 #include <sys/resource.h>
-#include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/types.h>
-#include <unistd.h>
 
 int restrict_process_init(void) {
   struct rlimit rl_zero = {0};
-  struct stat sb = {0};
-
-  if (fstat(STDOUT_FILENO, &sb) < 0)
-    return -1;
-
-  if (!S_ISREG(sb.st_mode)) {
-    if (setrlimit(RLIMIT_FSIZE, &rl_zero) < 0)
-      return -1;
-  }
 
   return setrlimit(RLIMIT_NPROC, &rl_zero);
 }
 
-int restrict_process_stdin(void) {
-  struct rlimit rl_zero = {0};
+/* limits are inherited by the command */
+int restrict_process_supervisor(void) { return 0; }
+
+int restrict_process_stdin(const int *fd, size_t nfd) {
+  /* poll(2) fails if the number of descriptors exceeds RLIMIT_NOFILE:
+   * descriptors 0-2 are open so none can be allocated */
+  struct rlimit rl_poll = {.rlim_cur = 3, .rlim_max = 3};
+
+  if (restrict_process_fsize(fd, nfd) < 0)
+    return -1;
 
-  return setrlimit(RLIMIT_NOFILE, &rl_zero);
+  return setrlimit(RLIMIT_NOFILE, &rl_poll);
 }
 #endif
@@ -16,6 +16,8 @@
 #ifdef RESTRICT_PROCESS_seccomp
 #include <errno.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <string.h>
 #include <sys/prctl.h>
 #include <sys/syscall.h>
 
@@ -34,24 +36,30 @@
 #define SECCOMP_FILTER_FAIL SECCOMP_RET_TRAP
 #endif /* RESTRICT_PROCESS_SECCOMP_FILTER_DEBUG */
 
-/* Simple helpers to avoid manual errors (but larger BPF programs). */
+/* Allow list entries: the BPF program is generated from the list by
+ * restrict_process_filter(). */
 #define SC_DENY(_nr, _errno)                                                   \
-  BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, __NR_##_nr, 0, 1)                        \
-  , BPF_STMT(BPF_RET + BPF_K, SECCOMP_RET_ERRNO | (_errno))
+  { __NR_##_nr, SECCOMP_RET_ERRNO | (_errno) }
 #define SC_ALLOW(_nr)                                                          \
-  BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, __NR_##_nr, 0, 1)                        \
-  , BPF_STMT(BPF_RET + BPF_K, SECCOMP_RET_ALLOW)
-#define SC_ALLOW_ARG(_nr, _arg_nr, _arg_val)                                   \
-  BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, __NR_##_nr, 0, 4)                        \
-  , /* load first syscall argument */                                          \
-      BPF_STMT(BPF_LD + BPF_W + BPF_ABS,                                       \
-               offsetof(struct seccomp_data, args[(_arg_nr)])),                \
-      BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, (_arg_val), 0, 1),                   \
-      BPF_STMT(                                                                \
-          BPF_RET + BPF_K, SECCOMP_RET_ALLOW), /* reload syscall number; all   \
-                                                  rules expect it in           \
-                                                  accumulator */               \
-      BPF_STMT(BPF_LD + BPF_W + BPF_ABS, offsetof(struct seccomp_data, nr))
+  { __NR_##_nr, SECCOMP_RET_ALLOW }
+
+/* Syscalls are matched using a binary search on the syscall number,
+ * switching to a linear search for ranges of this size or less. */
+#define SC_LEAF_MAX 4
+
+/* Maximum size of the generated BPF program */
+#define SC_FILTER_MAX 256
+
+typedef struct {
+  uint32_t nr;
+  uint32_t action;
+} restrict_process_rule_t;
+
+static int restrict_process_filter(const restrict_process_rule_t *rule,
+                                   size_t nrule);
+static int restrict_process_filter_tree(const restrict_process_rule_t *rule,
+                                        size_t lo, size_t hi,
+                                        struct sock_filter *filter, size_t *n);
 
 /*
  * http://outflux.net/teach-seccomp/
@@ -75,14 +83,7 @@
 #endif
 
 int restrict_process_init(void) {
-  struct sock_filter filter[] = {
-      /* Ensure the syscall arch convention is as expected. */
-      BPF_STMT(BPF_LD + BPF_W + BPF_ABS, offsetof(struct seccomp_data, arch)),
-      BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, SECCOMP_AUDIT_ARCH, 1, 0),
-      BPF_STMT(BPF_RET + BPF_K, SECCOMP_FILTER_FAIL),
-      /* Load the syscall number for checking. */
-      BPF_STMT(BPF_LD + BPF_W + BPF_ABS, offsetof(struct seccomp_data, nr)),
-
+  const restrict_process_rule_t rule[] = {
 /* Syscalls to non-fatally deny */
 
 /* Syscalls to allow */
@@ -128,10 +129,56 @@ int restrict_process_init(void) {
       SC_ALLOW(ioctl),
 #endif
 
+/* Used to map the state file */
+#ifdef __NR_open
+      SC_ALLOW(open),
+#endif
+#ifdef __NR_openat
+      SC_ALLOW(openat),
+#endif
+#ifdef __NR_ftruncate
+      SC_ALLOW(ftruncate),
+#endif
+/* Used to create the control FIFO */
+#ifdef __NR_mknod
+      SC_ALLOW(mknod),
+#endif
+#ifdef __NR_mknodat
+      SC_ALLOW(mknodat),
+#endif
+#ifdef __NR_mmap
+      SC_ALLOW(mmap),
+#endif
+#ifdef __NR_mmap2
+      SC_ALLOW(mmap2),
+#endif
+
 #ifdef __NR_gettimeofday
       SC_ALLOW(gettimeofday),
 #endif
 
+/* Used to wait for input and control commands */
+#ifdef __NR_poll
+      SC_ALLOW(poll),
+#endif
+#ifdef __NR_ppoll
+      SC_ALLOW(ppoll),
+#endif
+#ifdef __NR_ppoll_time64
+      SC_ALLOW(ppoll_time64),
+#endif
+
+/* Used to pace replay */
+#ifdef __NR_nanosleep
+      SC_ALLOW(nanosleep),
+#endif
+#ifdef __NR_clock_nanosleep
+      SC_ALLOW(clock_nanosleep),
+#endif
+#ifdef __NR_clock_nanosleep_time64
+      SC_ALLOW(clock_nanosleep_time64),
+#endif
+
 #ifdef __NR_pread
       SC_ALLOW(pread),
 #endif
@@ -187,30 +234,19 @@ int restrict_process_init(void) {
       SC_ALLOW(munmap),
 #endif
 #endif
-
-      /* Default deny */
-      BPF_STMT(BPF_RET + BPF_K, SECCOMP_FILTER_FAIL)};
-
-  struct sock_fprog prog = {
-      .len = (unsigned short)(sizeof(filter) / sizeof(filter[0])),
-      .filter = filter,
   };
 
   if (prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) < 0)
     return -1;
 
-  return prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, &prog);
+  return restrict_process_filter(rule, sizeof(rule) / sizeof(rule[0]));
 }
 
-int restrict_process_stdin(void) {
-  struct sock_filter filter[] = {
-      /* Ensure the syscall arch convention is as expected. */
-      BPF_STMT(BPF_LD + BPF_W + BPF_ABS, offsetof(struct seccomp_data, arch)),
-      BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, SECCOMP_AUDIT_ARCH, 1, 0),
-      BPF_STMT(BPF_RET + BPF_K, SECCOMP_FILTER_FAIL),
-      /* Load the syscall number for checking. */
-      BPF_STMT(BPF_LD + BPF_W + BPF_ABS, offsetof(struct seccomp_data, nr)),
+/* filters are inherited by the command */
+int restrict_process_supervisor(void) { return 0; }
 
+int restrict_process_stdin(const int *fd, size_t nfd) {
+  const restrict_process_rule_t rule[] = {
 /* Syscalls to non-fatally deny */
 #ifdef __NR__llseek
       SC_DENY(_llseek, ESPIPE),
@@ -256,6 +292,36 @@ int restrict_process_stdin(void) {
       SC_ALLOW(gettimeofday),
 #endif
 
+/* Used to wait for input and control commands */
+#ifdef __NR_poll
+      SC_ALLOW(poll),
+#endif
+#ifdef __NR_ppoll
+      SC_ALLOW(ppoll),
+#endif
+#ifdef __NR_ppoll_time64
+      SC_ALLOW(ppoll_time64),
+#endif
+
+/* Used to change the write error behaviour */
+#ifdef __NR_fcntl
+      SC_ALLOW(fcntl),
+#endif
+#ifdef __NR_fcntl64
+      SC_ALLOW(fcntl64),
+#endif
+
+/* Used to pace replay */
+#ifdef __NR_nanosleep
+      SC_ALLOW(nanosleep),
+#endif
+#ifdef __NR_clock_nanosleep
+      SC_ALLOW(clock_nanosleep),
+#endif
+#ifdef __NR_clock_nanosleep_time64
+      SC_ALLOW(clock_nanosleep_time64),
+#endif
+
 #ifdef __NR_pread
       SC_ALLOW(pread),
 #endif
@@ -306,15 +372,119 @@ int restrict_process_stdin(void) {
       SC_ALLOW(munmap),
 #endif
 #endif
+  };
+
+  return restrict_process_filter(rule, sizeof(rule) / sizeof(rule[0]));
+}
 
-      /* Default deny */
-      BPF_STMT(BPF_RET + BPF_K, SECCOMP_FILTER_FAIL)};
+static int restrict_process_filter(const restrict_process_rule_t *rule,
+                                   size_t nrule) {
+  struct sock_filter filter[SC_FILTER_MAX] = {
+      /* Ensure the syscall arch convention is as expected. */
+      BPF_STMT(BPF_LD + BPF_W + BPF_ABS, offsetof(struct seccomp_data, arch)),
+      BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, SECCOMP_AUDIT_ARCH, 1, 0),
+      BPF_STMT(BPF_RET + BPF_K, SECCOMP_FILTER_FAIL),
+      /* Load the syscall number for checking. */
+      BPF_STMT(BPF_LD + BPF_W + BPF_ABS, offsetof(struct seccomp_data, nr)),
+  };
+  restrict_process_rule_t sorted[SC_FILTER_MAX / 2];
+  size_t n = 4;
+  size_t nsorted = 0;
+  size_t i;
+#ifndef RESTRICT_PROCESS_SECCOMP_LINEAR
+  size_t j;
+#endif
 
   struct sock_fprog prog = {
-      .len = (unsigned short)(sizeof(filter) / sizeof(filter[0])),
       .filter = filter,
   };
 
+  if (nrule > sizeof(sorted) / sizeof(sorted[0])) {
+    errno = EINVAL;
+    return -1;
+  }
+
+#ifdef RESTRICT_PROCESS_SECCOMP_LINEAR
+  /* Check the syscalls in the order of the allow list */
+  for (i = 0; i < nrule; i++)
+    sorted[i] = rule[i];
+  nsorted = nrule;
+  if (restrict_process_filter_tree(sorted, 0, nsorted, filter, &n) < 0)
+    return -1;
+#else
+  /* insertion sort by syscall number, dropping duplicates */
+  for (i = 0; i < nrule; i++) {
+    for (j = nsorted; j > 0 && sorted[j - 1].nr > rule[i].nr; j--)
+      ;
+    if (j > 0 && sorted[j - 1].nr == rule[i].nr)
+      continue;
+    (void)memmove(&sorted[j + 1], &sorted[j],
+                  (nsorted - j) * sizeof(sorted[0]));
+    sorted[j] = rule[i];
+    nsorted++;
+  }
+
+  if (restrict_process_filter_tree(sorted, 0, nsorted, filter, &n) < 0)
+    return -1;
+#endif
+
+  prog.len = (unsigned short)n;
+
   return prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, &prog);
 }
+
+/* Generate a binary search tree: the left branch (syscall number less
+ * than the pivot) immediately follows the comparison. */
+static int restrict_process_filter_tree(const restrict_process_rule_t *rule,
+                                        size_t lo, size_t hi,
+                                        struct sock_filter *filter,
+                                        size_t *n) {
+  size_t i;
+
+#ifndef RESTRICT_PROCESS_SECCOMP_LINEAR
+  if (hi - lo > SC_LEAF_MAX) {
+    size_t mid;
+    size_t jge;
+
+    mid = lo + (hi - lo) / 2;
+
+    if (*n + 1 > SC_FILTER_MAX)
+      goto ERR;
+
+    jge = (*n)++;
+
+    if (restrict_process_filter_tree(rule, lo, mid, filter, n) < 0)
+      return -1;
+
+    /* BPF jump offsets are 8 bits */
+    if (*n - jge - 1 > UINT8_MAX)
+      goto ERR;
+
+    filter[jge] = (struct sock_filter)BPF_JUMP(
+        BPF_JMP + BPF_JGE + BPF_K, rule[mid].nr, *n - jge - 1, 0);
+
+    return restrict_process_filter_tree(rule, mid, hi, filter, n);
+  }
+#endif
+
+  if (*n + (hi - lo) * 2 + 1 > SC_FILTER_MAX)
+    goto ERR;
+
+  for (i = lo; i < hi; i++) {
+    filter[(*n)++] = (struct sock_filter)BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K,
+                                                  rule[i].nr, 0, 1);
+    filter[(*n)++] =
+        (struct sock_filter)BPF_STMT(BPF_RET + BPF_K, rule[i].action);
+  }
+
+  /* Default deny */
+  filter[(*n)++] =
+      (struct sock_filter)BPF_STMT(BPF_RET + BPF_K, SECCOMP_FILTER_FAIL);
+
+  return 0;
+
+ERR:
+  errno = EINVAL;
+  return -1;
+}
 #endif
@@ -137,6 +137,22 @@ EOF
     [ "$output" = "$result" ]
 }
 
+@test "lines are not split at the input buffer boundary" {
+    OUT="$BATS_TMPDIR/prv-seq.$$"
+    run sh -c "seq 1 20000 | collectd-prv --hostname=test --limit=0 | sed 's/.*message=\"//; s/\"\$//' > $OUT"
+    [ "$status" -eq 0 ]
+
+    run sh -c "seq 1 20000 | diff - $OUT"
+    rm -f "$OUT"
+    cat << EOF
+--- output
+$output
+--- output
+EOF
+
+    [ "$status" -eq 0 ]
+}
+
 @test "discard limit" {
     run sh -c "yes \"$MSG\" | head -10 | collectd-prv --limit=3 --window=10 --hostname=test | sed 's/time=[0-9]* //'"
     cat << EOF
@@ -342,3 +358,635 @@ EOF
     *) skip ;;
     esac
 }
+
+@test "state: limit is preserved across restarts" {
+    STATE="$BATS_TMPDIR/collectd-prv-state.$$"
+    rm -f "$STATE"
+    run sh -c "yes \"$MSG\" | head -2 | collectd-prv --limit=3 --window=60 --state=$STATE --hostname=test"
+    [ "$status" -eq 0 ]
+    run sh -c "yes \"$MSG\" | head -10 | collectd-prv --limit=3 --window=60 --state=$STATE --hostname=test | sed 's/time=[0-9]* //'"
+    rm -f "$STATE"
+    cat << EOF
+--- output
+$output
+--- output
+EOF
+
+    [ "$status" -eq 0 ]
+
+    result="PUTNOTIF host=test severity=okay plugin=stdout type=prv message=\"$MSG\""
+
+    cat << EOF
+--- expected
+$result
+--- expected
+EOF
+    [ "$output" = "$result" ]
+}
+
+@test "state: sliding window limits are preserved across restarts" {
+    STATE="$BATS_TMPDIR/collectd-prv-state.$$"
+    rm -f "$STATE"
+    run sh -c "yes \"$MSG\" | head -2 | collectd-prv --limit=3/m --state=$STATE --hostname=test"
+    [ "$status" -eq 0 ]
+    [ "${#lines[@]}" -eq 2 ]
+    run sh -c "yes \"$MSG\" | head -10 | collectd-prv --limit=3/m --state=$STATE --hostname=test | sed 's/time=[0-9]* //'"
+    rm -f "$STATE"
+    cat << EOF
+--- output
+$output
+--- output
+EOF
+
+    [ "$status" -eq 0 ]
+
+    result="PUTNOTIF host=test severity=okay plugin=stdout type=prv message=\"$MSG\""
+
+    cat << EOF
+--- expected
+$result
+--- expected
+EOF
+    [ "$output" = "$result" ]
+}
+
+@test "state: fragment id is preserved across restarts" {
+    STATE="$BATS_TMPDIR/collectd-prv-state.$$"
+    rm -f "$STATE"
+    run sh -c "echo 'ab' | collectd-prv --max-event-length=1 --state=$STATE --hostname=test"
+    [ "$status" -eq 0 ]
+    run sh -c "echo 'ab' | collectd-prv --max-event-length=1 --state=$STATE --hostname=test | sed 's/time=[0-9]* //'"
+    rm -f "$STATE"
+    cat << EOF
+--- output
+$output
+--- output
+EOF
+
+    [ "$status" -eq 0 ]
+
+    result='PUTNOTIF host=test severity=okay plugin=stdout type=prv message="@2:1:2@a"
+PUTNOTIF host=test severity=okay plugin=stdout type=prv message="@2:2:2@b"'
+
+    cat << EOF
+--- expected
+$result
+--- expected
+EOF
+    [ "$output" = "$result" ]
+}
+
+@test "state: corrupt state file is reset" {
+    STATE="$BATS_TMPDIR/collectd-prv-state.$$"
+    head -c 40 /dev/urandom > "$STATE"
+    run sh -c "echo \"$MSG\" | collectd-prv --limit=1 --window=60 --state=$STATE --hostname=test | sed 's/time=[0-9]* //'"
+    rm -f "$STATE"
+    cat << EOF
+--- output
+$output
+--- output
+EOF
+
+    [ "$status" -eq 0 ]
+
+    result="PUTNOTIF host=test severity=okay plugin=stdout type=prv message=\"$MSG\""
+
+    cat << EOF
+--- expected
+$result
+--- expected
+EOF
+    [ "$output" = "$result" ]
+}
+
+@test "top: flood summary at window rollover" {
+    run sh -c "(for i in 1 2 3 4 5; do echo \"error id=\$i addr=0x7f\$i user='bob\$i'\"; done; echo 'warn deadbeef'; echo 'warn deadbeef'; sleep 1.2; echo next) | collectd-prv --limit=1 --window=1 --top=2 --hostname=test | sed 's/time=[0-9]* //'"
+    cat << EOF
+--- output
+$output
+--- output
+EOF
+
+    [ "$status" -eq 0 ]
+
+    result="PUTNOTIF host=test severity=okay plugin=stdout type=prv message=\"error id=1 addr=0x7f1 user='bob1'\"
+PUTNOTIF host=test severity=warning plugin=stdout type=prv message=\"flood:lines=7:discarded=6:5:error id=# addr=# user='*'|2:warn deadbeef\"
+PUTNOTIF host=test severity=okay plugin=stdout type=prv message=\"next\""
+
+    cat << EOF
+--- expected
+$result
+--- expected
+EOF
+    [ "$output" = "$result" ]
+}
+
+@test "record and replay" {
+    RECORD="$BATS_TMPDIR/collectd-prv-record.$$"
+    run sh -c "(echo a; echo b; echo c; sleep 1.1; echo d; echo eeeeeee) | collectd-prv --limit=2 --window=1 --max-event-length=3 --record=$RECORD --hostname=test >/dev/null"
+    [ "$status" -eq 0 ]
+    run sh -c "collectd-prv --limit=2 --window=1 --max-event-length=3 --replay=$RECORD --replay-speed=0 --hostname=test 2>&1 >/dev/null"
+    rm -f "$RECORD"
+    cat << EOF
+--- output
+$output
+--- output
+EOF
+
+    [ "$status" -eq 0 ]
+
+    result="REPLAY:lines=5:emitted=3:discarded=2:fragmented=0"
+
+    cat << EOF
+--- expected
+$result
+--- expected
+EOF
+    [ "$output" = "$result" ]
+}
+
+@test "replay: fragments" {
+    RECORD="$BATS_TMPDIR/collectd-prv-record.$$"
+    run sh -c "echo \"$MSG\" | collectd-prv --record=$RECORD --hostname=test >/dev/null"
+    [ "$status" -eq 0 ]
+    run sh -c "collectd-prv --max-event-length=3 --replay=$RECORD --hostname=test 2>&1 >/dev/null"
+    rm -f "$RECORD"
+    cat << EOF
+--- output
+$output
+--- output
+EOF
+
+    [ "$status" -eq 0 ]
+
+    result="REPLAY:lines=1:emitted=14:discarded=0:fragmented=1"
+
+    [ "$output" = "$result" ]
+}
+
+@test "replay: invalid file" {
+    RECORD="$BATS_TMPDIR/collectd-prv-record.$$"
+    echo "$MSG" > "$RECORD"
+    run collectd-prv --replay=$RECORD
+    rm -f "$RECORD"
+    [ "$status" -ne 0 ]
+}
+
+@test "record: records are written before the process is terminated" {
+    RECORD="$BATS_TMPDIR/collectd-prv-record.$$"
+    rm -f "$RECORD"
+    (printf 'line1\nline2\n'; sleep 5) | collectd-prv --record=$RECORD > /dev/null &
+    sleep 1
+    pkill -TERM -f "collectd-prv --record=$RECORD"
+    wait
+    run sh -c "collectd-prv --replay=$RECORD --replay-speed=0 2>&1 >/dev/null"
+    rm -f "$RECORD"
+    cat << EOF
+--- output
+$output
+--- output
+EOF
+
+    [ "$status" -eq 0 ]
+    [ "$output" = "REPLAY:lines=2:emitted=2:discarded=0:fragmented=0" ]
+}
+
+@test "replay: summary written to a file" {
+    RECORD="$BATS_TMPDIR/collectd-prv-record.$$"
+    printf 'line1\n' | collectd-prv --record=$RECORD > /dev/null
+    run sh -c "collectd-prv --replay=$RECORD --replay-speed=0 > /dev/null 2> $RECORD.summary; cat $RECORD.summary"
+    rm -f "$RECORD" "$RECORD.summary"
+
+    [ "$status" -eq 0 ]
+    [ "$output" = "REPLAY:lines=1:emitted=1:discarded=0:fragmented=0" ]
+}
+
+@test "replay: truncated record" {
+    RECORD="$BATS_TMPDIR/collectd-prv-record.$$"
+    printf 'line1\nline2\n' | collectd-prv --record=$RECORD > /dev/null
+    size=$(wc -c < "$RECORD")
+    head -c $((size - 2)) "$RECORD" > "$RECORD.1"
+    run sh -c "collectd-prv --replay=$RECORD.1 --replay-speed=0 2>&1 >/dev/null"
+    rm -f "$RECORD" "$RECORD.1"
+    cat << EOF
+--- output
+$output
+--- output
+EOF
+
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "collectd-prv: replay: truncated record" ]
+    [ "${lines[1]}" = "REPLAY:lines=1:emitted=1:discarded=0:fragmented=0" ]
+}
+
+@test "limit: multiple tiers" {
+    run sh -c "(for i in 1 2 3 4 5; do echo a\$i; done; sleep 1.1; for i in 1 2 3 4 5; do echo b\$i; done) | collectd-prv --limit=3/s --limit=5/m --hostname=test | sed 's/time=[0-9]* //'"
+    cat << EOF
+--- output
+$output
+--- output
+EOF
+
+    [ "$status" -eq 0 ]
+
+    result='PUTNOTIF host=test severity=okay plugin=stdout type=prv message="a1"
+PUTNOTIF host=test severity=okay plugin=stdout type=prv message="a2"
+PUTNOTIF host=test severity=okay plugin=stdout type=prv message="a3"
+PUTNOTIF host=test severity=okay plugin=stdout type=prv message="b1"
+PUTNOTIF host=test severity=okay plugin=stdout type=prv message="b2"'
+
+    cat << EOF
+--- expected
+$result
+--- expected
+EOF
+    [ "$output" = "$result" ]
+}
+
+@test "limit: sliding window" {
+    run sh -c "(echo a1; echo a2; sleep 1.1; echo b1; sleep 1.1; echo c1) | collectd-prv --limit=2/2s --hostname=test | sed 's/time=[0-9]* //'"
+    cat << EOF
+--- output
+$output
+--- output
+EOF
+
+    [ "$status" -eq 0 ]
+
+    result='PUTNOTIF host=test severity=okay plugin=stdout type=prv message="a1"
+PUTNOTIF host=test severity=okay plugin=stdout type=prv message="a2"
+PUTNOTIF host=test severity=okay plugin=stdout type=prv message="c1"'
+
+    cat << EOF
+--- expected
+$result
+--- expected
+EOF
+    [ "$output" = "$result" ]
+}
+
+@test "limit: fragments are charged to every tier" {
+    run sh -c "(echo 123456; echo 7) | collectd-prv --limit=3/s --limit=100/m --max-event-length=2 --hostname=test | sed 's/time=[0-9]* //'"
+    cat << EOF
+--- output
+$output
+--- output
+EOF
+
+    [ "$status" -eq 0 ]
+
+    result='PUTNOTIF host=test severity=okay plugin=stdout type=prv message="@1:1:3@12"
+PUTNOTIF host=test severity=okay plugin=stdout type=prv message="@1:2:3@34"
+PUTNOTIF host=test severity=okay plugin=stdout type=prv message="@1:3:3@56"'
+
+    cat << EOF
+--- expected
+$result
+--- expected
+EOF
+    [ "$output" = "$result" ]
+}
+
+@test "limit: invalid period" {
+    run collectd-prv --limit=3/x
+    [ "$status" -ne 0 ]
+}
+
+@test "control: set limit and dump counters" {
+    CONTROL="$BATS_TMPDIR/collectd-prv-control.$$"
+    rm -f "$CONTROL"
+    mkfifo "$CONTROL"
+    run sh -c "((echo a; sleep 1; echo b; echo c) | collectd-prv --control=$CONTROL --window=60 --hostname=test | sed 's/time=[0-9]* //') & sleep 0.5; printf 'limit 2\ndump\n' > $CONTROL; wait"
+    rm -f "$CONTROL"
+    cat << EOF
+--- output
+$output
+--- output
+EOF
+
+    [ "$status" -eq 0 ]
+
+    result='COUNTERS:count=1:limit=2:window=60:write-error=block:lines=1:emitted=1:discarded=0:fragmented=0
+PUTNOTIF host=test severity=okay plugin=stdout type=prv message="a"
+PUTNOTIF host=test severity=okay plugin=stdout type=prv message="b"'
+
+    cat << EOF
+--- expected
+$result
+--- expected
+EOF
+    [ "$output" = "$result" ]
+}
+
+@test "control: set sliding window limit" {
+    CONTROL="$BATS_TMPDIR/collectd-prv-control.$$"
+    rm -f "$CONTROL"
+    mkfifo "$CONTROL"
+    run sh -c "((echo a; sleep 1; echo b; echo c) | collectd-prv --control=$CONTROL --limit=5/m --hostname=test | sed 's/time=[0-9]* //') & sleep 0.5; printf 'limit 2/m\n' > $CONTROL; wait"
+    rm -f "$CONTROL"
+    cat << EOF
+--- output
+$output
+--- output
+EOF
+
+    [ "$status" -eq 0 ]
+
+    result='PUTNOTIF host=test severity=okay plugin=stdout type=prv message="a"
+PUTNOTIF host=test severity=okay plugin=stdout type=prv message="b"'
+
+    cat << EOF
+--- expected
+$result
+--- expected
+EOF
+    [ "$output" = "$result" ]
+}
+
+@test "supervise: read command output" {
+    run sh -c "collectd-prv --hostname=test -- sh -c 'echo \"$MSG\"; echo stderr >&2' 2>/dev/null | sed 's/time=[0-9]* //'"
+    cat << EOF
+--- output
+$output
+--- output
+EOF
+
+    [ "$status" -eq 0 ]
+
+    result="PUTNOTIF host=test severity=okay plugin=stdout type=prv message=\"$MSG\""
+
+    cat << EOF
+--- expected
+$result
+--- expected
+EOF
+    [ "$output" = "$result" ]
+}
+
+@test "supervise: capture stderr" {
+    run sh -c "collectd-prv --hostname=test --capture-stderr -- sh -c 'echo \"$MSG\" >&2' | sed 's/time=[0-9]* //'"
+    cat << EOF
+--- output
+$output
+--- output
+EOF
+
+    [ "$status" -eq 0 ]
+
+    result="PUTNOTIF host=test severity=warning plugin=stdout type=prv message=\"$MSG\""
+
+    cat << EOF
+--- expected
+$result
+--- expected
+EOF
+    [ "$output" = "$result" ]
+}
+
+@test "supervise: restart command" {
+    run sh -c "collectd-prv --hostname=test --restart=1 -- echo \"$MSG\" | sed 's/time=[0-9]* //'"
+    cat << EOF
+--- output
+$output
+--- output
+EOF
+
+    [ "$status" -eq 0 ]
+
+    result="PUTNOTIF host=test severity=okay plugin=stdout type=prv message=\"$MSG\"
+PUTNOTIF host=test severity=okay plugin=stdout type=prv message=\"$MSG\""
+
+    cat << EOF
+--- expected
+$result
+--- expected
+EOF
+    [ "$output" = "$result" ]
+}
+
+@test "supervise: exit status of command" {
+    run sh -c "collectd-prv -- sh -c 'exit 3'"
+    cat << EOF
+--- output
+$output
+--- output
+EOF
+
+    [ "$status" -eq 3 ]
+}
+
+@test "supervise: terminate command" {
+    run sh -c "collectd-prv --hostname=test -- sh -c 'echo \"$MSG\"; exec sleep 60' & pid=\$!; sleep 1; kill \$pid; wait \$pid"
+    cat << EOF
+--- output
+$output
+--- output
+EOF
+
+    [ "$status" -eq 0 ]
+    [ "${#lines[@]}" -eq 1 ]
+}
+
+@test "supervise: forward SIGHUP to command" {
+    run sh -c "collectd-prv --hostname=test -- sh -c 'trap \"echo hup\" HUP; echo ready; while :; do sleep 0.1; done' 2>/dev/null & pid=\$!; sleep 1; kill -HUP \$pid; sleep 1; kill \$pid; wait \$pid"
+    cat << EOF
+--- output
+$output
+--- output
+EOF
+
+    [ "$status" -eq 0 ]
+    [ "${#lines[@]}" -eq 2 ]
+    [[ "${lines[1]}" == *'message="hup"' ]]
+}
+
+@test "count: counters are sent as PUTVAL" {
+    run sh -c "printf 'fail 1\nok\nfail 2\noops\n' | collectd-prv --hostname=test --count='fail=^fail [0-9]+$' --count=oops=oops | sed 's/ [0-9]*:/ T:/'"
+    cat << EOF
+--- output
+$output
+--- output
+EOF
+
+    [ "$status" -eq 0 ]
+
+    result='PUTVAL "test/stdout-prv/derive-fail" interval=1 T:2
+PUTVAL "test/stdout-prv/derive-oops" interval=1 T:1'
+
+    cat << EOF
+--- expected
+$result
+--- expected
+EOF
+    [ "$output" = "$result" ]
+}
+
+@test "count: gauge is reset at window rollover" {
+    run sh -c "(echo match; echo match; sleep 2; echo match) | collectd-prv --hostname=test --window=2 --count=m=match --count-type=gauge | sed 's/ [0-9]*:/ T:/'"
+    cat << EOF
+--- output
+$output
+--- output
+EOF
+
+    [ "$status" -eq 0 ]
+
+    result='PUTVAL "test/stdout-prv/gauge-m" interval=2 T:2
+PUTVAL "test/stdout-prv/gauge-m" interval=2 T:1'
+
+    cat << EOF
+--- expected
+$result
+--- expected
+EOF
+    [ "$output" = "$result" ]
+}
+
+@test "count: counters are sent for windows without input" {
+    run sh -c "(echo match; sleep 3) | collectd-prv --hostname=test --count=m=match --count-type=gauge | sed 's/ [0-9]*:/ T:/'"
+    cat << EOF
+--- output
+$output
+--- output
+EOF
+
+    [ "$status" -eq 0 ]
+    [ "${#lines[@]}" -ge 3 ]
+    [ "${lines[0]}" = 'PUTVAL "test/stdout-prv/gauge-m" interval=1 T:1' ]
+    [ "${lines[1]}" = 'PUTVAL "test/stdout-prv/gauge-m" interval=1 T:0' ]
+}
+
+@test "count: exit after rollover uses a newer timestamp" {
+    run sh -c "(echo 'error a'; sleep 1.3) | collectd-prv --hostname=test --count=err=^error"
+    cat << EOF
+--- output
+$output
+--- output
+EOF
+
+    [ "$status" -eq 0 ]
+    [ "${#lines[@]}" -eq 2 ]
+    t0="${lines[0]##* }"
+    t1="${lines[1]##* }"
+    [ "${t1%%:*}" -gt "${t0%%:*}" ]
+}
+
+@test "count: sampled notifications" {
+    run sh -c "printf 'fail 1\nfail 2\nfail 3\n' | collectd-prv --hostname=test --count=fail=fail --count-sample=1 | sed 's/time=[0-9]* //; s/ [0-9]*:/ T:/'"
+    cat << EOF
+--- output
+$output
+--- output
+EOF
+
+    [ "$status" -eq 0 ]
+
+    result='PUTNOTIF host=test severity=okay plugin=stdout type=prv message="fail 1"
+PUTVAL "test/stdout-prv/derive-fail" interval=1 T:3'
+
+    cat << EOF
+--- expected
+$result
+--- expected
+EOF
+    [ "$output" = "$result" ]
+}
+
+@test "count: invalid rule" {
+    run sh -c "echo | collectd-prv --count='bad name=x'"
+    [ "$status" -ne 0 ]
+
+    run sh -c "echo | collectd-prv --count='x=('"
+    [ "$status" -ne 0 ]
+
+    run sh -c "echo | collectd-prv --count=x=y --count-type=counter"
+    [ "$status" -ne 0 ]
+}
+
+@test "spool: lines exceeding the limit are delayed" {
+    SPOOL="$BATS_TMPDIR/prv-spool.$$"
+    rm -f "$SPOOL"
+    run sh -c "(printf 'line1\nline2\nline3\n'; sleep 3) | collectd-prv --hostname=test --limit=1 --spool=$SPOOL | sed 's/time=[0-9]* //'"
+    rm -f "$SPOOL"
+    cat << EOF
+--- output
+$output
+--- output
+EOF
+
+    [ "$status" -eq 0 ]
+
+    result='PUTNOTIF host=test severity=okay plugin=stdout type=prv message="line1"
+PUTNOTIF host=test severity=okay plugin=stdout type=prv message="line2"
+PUTNOTIF host=test severity=okay plugin=stdout type=prv message="line3"'
+
+    cat << EOF
+--- expected
+$result
+--- expected
+EOF
+    [ "$output" = "$result" ]
+}
+
+@test "spool: original timestamps are preserved across restarts" {
+    SPOOL="$BATS_TMPDIR/prv-spool.$$"
+    rm -f "$SPOOL"
+    run sh -c "printf 'line1\nline2\n' | collectd-prv --hostname=test --limit=1 --spool=$SPOOL"
+    [ "$status" -eq 0 ]
+    [ "${#lines[@]}" -eq 1 ]
+    t="${lines[0]#*time=}"
+    t="${t%% *}"
+
+    sleep 2
+
+    run sh -c "echo line3 | collectd-prv --hostname=test --spool=$SPOOL"
+    rm -f "$SPOOL"
+    cat << EOF
+--- output
+$output
+--- output
+EOF
+
+    [ "$status" -eq 0 ]
+    [ "${#lines[@]}" -eq 2 ]
+    [ "${lines[0]}" = "PUTNOTIF host=test severity=okay time=$t plugin=stdout type=prv message=\"line2\"" ]
+    [ "${lines[1]##*message=}" = '"line3"' ]
+    [ "${lines[1]}" != "PUTNOTIF host=test severity=okay time=$t plugin=stdout type=prv message=\"line3\"" ]
+}
+
+@test "spool: lines exceeding a lowered limit are discarded" {
+    SPOOL="$BATS_TMPDIR/prv-spool.$$"
+    rm -f "$SPOOL"
+    line="$(printf '%250s' | tr ' ' x)"
+    run sh -c "printf '$line\n$line\n$line\n' | collectd-prv --hostname=test --limit=5 --max-event-length=100 --spool=$SPOOL"
+    [ "$status" -eq 0 ]
+    [ "${#lines[@]}" -eq 3 ]
+
+    run sh -c "echo test | collectd-prv --hostname=test --limit=1 --max-event-length=100 --spool=$SPOOL"
+    rm -f "$SPOOL"
+    cat << EOF
+--- output
+$output
+--- output
+EOF
+
+    [ "$status" -eq 0 ]
+    [ "${#lines[@]}" -eq 1 ]
+    [ "${lines[0]##*message=}" = '"test"' ]
+}
+
+@test "spool: lines are discarded if the spool is full" {
+    SPOOL="$BATS_TMPDIR/prv-spool.$$"
+    rm -f "$SPOOL"
+    run sh -c "seq 1 1000 | collectd-prv --hostname=test --limit=1 --spool=$SPOOL --spool-size=4096"
+    [ "$status" -eq 0 ]
+    [ "${#lines[@]}" -eq 1 ]
+
+    run sh -c "echo | collectd-prv --hostname=test --spool=$SPOOL --spool-size=4096"
+    rm -f "$SPOOL"
+
+    [ "$status" -eq 0 ]
+    [ "${#lines[@]}" -gt 1 ]
+    [ "${#lines[@]}" -lt 999 ]
+    [ "${lines[0]##*message=}" = '"2"' ]
+}
@@ -0,0 +1,91 @@
+#!/usr/bin/env bats
+
+HARNESS="test/collectd/harness test/collectd/prv.so"
+
+setup() {
+    LOG="$BATS_TMPDIR/prv-plugin.$$"
+    printf 'line1\nline2\nline3\nline4\n' > "$LOG"
+}
+
+teardown() {
+    rm -f "$LOG"
+}
+
+@test "plugin: dispatch lines from beginning of file" {
+    run sh -c "$HARNESS 1 File=$LOG FromBeginning=true Hostname=test"
+    cat << EOF
+--- output
+$output
+--- output
+EOF
+
+    [ "$status" -eq 0 ]
+
+    result='PUTNOTIF host=test severity=okay plugin=tail type=prv message="line1"
+PUTNOTIF host=test severity=okay plugin=tail type=prv message="line2"
+PUTNOTIF host=test severity=okay plugin=tail type=prv message="line3"
+PUTNOTIF host=test severity=okay plugin=tail type=prv message="line4"'
+
+    cat << EOF
+--- expected
+$result
+--- expected
+EOF
+    [ "$output" = "$result" ]
+}
+
+@test "plugin: start at end of file" {
+    run sh -c "$HARNESS 1 File=$LOG Hostname=test"
+    cat << EOF
+--- output
+$output
+--- output
+EOF
+
+    [ "$status" -eq 0 ]
+    [ "$output" = "" ]
+}
+
+@test "plugin: limit and service" {
+    run sh -c "$HARNESS 1 File=$LOG FromBeginning=true Hostname=test Limit=2 Service=syslog/messages"
+    cat << EOF
+--- output
+$output
+--- output
+EOF
+
+    [ "$status" -eq 0 ]
+
+    result='PUTNOTIF host=test severity=okay plugin=syslog type=messages message="line1"
+PUTNOTIF host=test severity=okay plugin=syslog type=messages message="line2"'
+
+    cat << EOF
+--- expected
+$result
+--- expected
+EOF
+    [ "$output" = "$result" ]
+}
+
+@test "plugin: invalid configuration" {
+    run sh -c "$HARNESS 1 File=$LOG Service=syslog"
+    cat << EOF
+--- output
+$output
+--- output
+EOF
+
+    [ "$status" -ne 0 ]
+}
+
+@test "plugin: invalid sliding window limit" {
+    run sh -c "$HARNESS 1 File=$LOG Limit=10/1x Service=syslog/messages"
+    cat << EOF
+--- output
+$output
+--- output
+EOF
+
+    [ "$status" -ne 0 ]
+    [[ "$output" == *"invalid limit: <number>/<period>: 10/1x"* ]]
+}
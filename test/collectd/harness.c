@@ -0,0 +1,146 @@
+/* Copyright (c) 2017-2025, Michael Santos <michael.santos@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Minimal collectd stand-in: loads a plugin, applies the configuration
+ * and runs the read callback. Notifications are written to stdout in the
+ * exec plugin format, without the time.
+ *
+ * harness <plugin.so> <reads> [<key>=<value> ...]
+ */
+#include <dlfcn.h>
+#include <err.h>
+#include <stdarg.h>
+#include <strings.h>
+#include <unistd.h>
+
+#include "collectd.h"
+#include "plugin.h"
+
+static int (*config_cb)(const char *key, const char *val);
+static const char **config_keys;
+static int config_keys_num;
+static plugin_init_cb init_cb;
+static plugin_read_cb read_cb;
+static plugin_shutdown_cb shutdown_cb;
+
+int plugin_register_config(const char *name,
+                           int (*callback)(const char *key, const char *val),
+                           const char **keys, int keys_num) {
+  config_cb = callback;
+  config_keys = keys;
+  config_keys_num = keys_num;
+  return 0;
+}
+
+int plugin_register_init(const char *name, plugin_init_cb callback) {
+  init_cb = callback;
+  return 0;
+}
+
+int plugin_register_read(const char *name, plugin_read_cb callback) {
+  read_cb = callback;
+  return 0;
+}
+
+int plugin_register_shutdown(const char *name, plugin_shutdown_cb callback) {
+  shutdown_cb = callback;
+  return 0;
+}
+
+int plugin_dispatch_notification(const notification_t *notif) {
+  const char *severity;
+
+  switch (notif->severity) {
+  case NOTIF_FAILURE:
+    severity = "failure";
+    break;
+  case NOTIF_WARNING:
+    severity = "warning";
+    break;
+  default:
+    severity = "okay";
+    break;
+  }
+
+  (void)printf("PUTNOTIF host=%s severity=%s plugin=%s type=%s "
+               "message=\"%s\"\n",
+               notif->host, severity, notif->plugin, notif->type,
+               notif->message);
+
+  return 0;
+}
+
+void plugin_log(int level, const char *format, ...) {
+  va_list ap;
+
+  va_start(ap, format);
+  (void)vfprintf(stderr, format, ap);
+  va_end(ap);
+  (void)fputc('\n', stderr);
+}
+
+int main(int argc, char *argv[]) {
+  void (*reg)(void);
+  void *handle;
+  char *val;
+  int reads;
+  int i;
+  int k;
+
+  if (argc < 3)
+    errx(EXIT_FAILURE, "usage: <plugin.so> <reads> [<key>=<value> ...]");
+
+  handle = dlopen(argv[1], RTLD_NOW);
+  if (handle == NULL)
+    errx(EXIT_FAILURE, "dlopen: %s", dlerror());
+
+  *(void **)(&reg) = dlsym(handle, "module_register");
+  if (reg == NULL)
+    errx(EXIT_FAILURE, "dlsym: %s", dlerror());
+
+  reg();
+
+  reads = atoi(argv[2]);
+
+  for (i = 3; i < argc; i++) {
+    val = strchr(argv[i], '=');
+    if (val == NULL)
+      errx(EXIT_FAILURE, "invalid option: %s", argv[i]);
+    *val++ = '\0';
+
+    for (k = 0; k < config_keys_num; k++) {
+      if (strcasecmp(argv[i], config_keys[k]) == 0)
+        break;
+    }
+
+    if (k == config_keys_num || config_cb(argv[i], val) != 0)
+      errx(EXIT_FAILURE, "config: %s=%s", argv[i], val);
+  }
+
+  if (init_cb != NULL && init_cb() != 0)
+    errx(EXIT_FAILURE, "init");
+
+  for (i = 0; i < reads; i++) {
+    if (read_cb() != 0)
+      errx(EXIT_FAILURE, "read");
+    if (i + 1 < reads)
+      (void)sleep(1);
+  }
+
+  if (shutdown_cb != NULL && shutdown_cb() != 0)
+    errx(EXIT_FAILURE, "shutdown");
+
+  exit(0);
+}
@@ -0,0 +1,68 @@
+/* Copyright (c) 2017-2025, Michael Santos <michael.santos@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Stand-in for the subset of the collectd plugin API used by prv_plugin.c.
+ * Declarations follow collectd 5.x src/daemon/plugin.h. */
+#ifndef PLUGIN_H
+#define PLUGIN_H
+
+#include <stdint.h>
+#include <syslog.h>
+
+#define DATA_MAX_NAME_LEN 128
+#define NOTIF_MAX_MSG_LEN 256
+
+#define NOTIF_FAILURE 1
+#define NOTIF_WARNING 2
+#define NOTIF_OKAY 4
+
+typedef uint64_t cdtime_t;
+
+#define TIME_T_TO_CDTIME_T(t) (((cdtime_t)(t)) << 30)
+
+typedef struct notification_meta_s notification_meta_t;
+
+typedef struct notification_s {
+  int severity;
+  cdtime_t time;
+  char message[NOTIF_MAX_MSG_LEN];
+  char host[DATA_MAX_NAME_LEN];
+  char plugin[DATA_MAX_NAME_LEN];
+  char plugin_instance[DATA_MAX_NAME_LEN];
+  char type[DATA_MAX_NAME_LEN];
+  char type_instance[DATA_MAX_NAME_LEN];
+  notification_meta_t *meta;
+} notification_t;
+
+typedef int (*plugin_init_cb)(void);
+typedef int (*plugin_read_cb)(void);
+typedef int (*plugin_shutdown_cb)(void);
+
+int plugin_register_config(const char *name,
+                           int (*callback)(const char *key, const char *val),
+                           const char **keys, int keys_num);
+int plugin_register_init(const char *name, plugin_init_cb callback);
+int plugin_register_read(const char *name, plugin_read_cb callback);
+int plugin_register_shutdown(const char *name, plugin_shutdown_cb callback);
+
+int plugin_dispatch_notification(const notification_t *notif);
+
+void plugin_log(int level, const char *format, ...);
+
+#define ERROR(...) plugin_log(LOG_ERR, __VA_ARGS__)
+
+void module_register(void);
+
+#endif